@@ -0,0 +1,285 @@
+/* fileio.c -- sequential bulk file access (used for body hashing)
+ *
+ * Copyright 2026 The liboauth contributors (see git log)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#if defined HAVE_SYS_MMAN_H && defined HAVE_MMAP
+# include <sys/mman.h>
+# define FILEIO_USE_MMAP
+#endif
+
+#include "xmalloc.h"
+#include "fileio.h"
+
+#ifndef O_BINARY
+# define O_BINARY 0
+#endif
+
+/* size of the region that is mapped at once. Large files are
+ * mapped in windows, so that 32bit hosts do not run out of
+ * address-space.
+ */
+#define FILEIO_MAP_WINDOW (64*1024*1024)
+
+/* read(2) buffer size for files that can not be mapped */
+#define FILEIO_READ_BUFSIZ (1024*1024)
+
+static void *fileio_buffer_alloc(size_t size) {
+#ifdef HAVE_POSIX_MEMALIGN
+	void *ptr = NULL;
+	if (posix_memalign(&ptr, 4096, size) == 0) return ptr;
+#endif
+	return xmalloc(size);
+}
+
+/**
+ * read file from offset 'off' until EOF using large aligned buffers.
+ * Also works with pipes and other non-seekable files if off==0.
+ */
+static int fileio_read_fd(int fd, off_t off, fileio_cb cb, void *arg) {
+	unsigned char *buf;
+	ssize_t len;
+	int rv = 0;
+
+	if (off > 0 && lseek(fd, off, SEEK_SET) != off) return -1;
+
+	buf = (unsigned char*) fileio_buffer_alloc(FILEIO_READ_BUFSIZ);
+	for (;;) {
+		len = read(fd, buf, FILEIO_READ_BUFSIZ);
+		if (len < 0) {
+			if (errno == EINTR) continue;
+			rv = -1;
+			break;
+		}
+		if (len == 0) break;
+		if ((rv = cb(arg, buf, len))) break;
+	}
+	free(buf);
+	return rv;
+}
+
+#ifdef FILEIO_USE_MMAP
+/**
+ * map a regular file window by window and pass the pages directly
+ * to the callback (no copy). *done is set to the number of bytes
+ * that have been processed, so the caller can continue with
+ * read(2) if mapping fails half-way.
+ */
+static int fileio_read_mmap(int fd, off_t size, fileio_cb cb, void *arg, off_t *done) {
+	off_t off = 0;
+	int rv = 0;
+
+	while (off < size) {
+		size_t len = (size - off) > FILEIO_MAP_WINDOW ? FILEIO_MAP_WINDOW : (size_t) (size - off);
+		void *map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, off);
+		if (map == MAP_FAILED) break;
+#ifdef HAVE_MADVISE
+		madvise(map, len, MADV_SEQUENTIAL);
+		madvise(map, len, MADV_WILLNEED);
+#endif
+		rv = cb(arg, (const unsigned char*) map, len);
+		munmap(map, len);
+		if (rv) break;
+		off += len;
+	}
+	*done = off;
+	return rv;
+}
+#endif
+
+/**
+ * pass the complete content of the file to the given callback.
+ *
+ * Regular files are mmap()ed (if available) with sequential
+ * read-ahead advice; everything else is read in large chunks.
+ * File sizes are handled as off_t (64bit with large-file support).
+ *
+ * @param filename the file to read
+ * @param cb function that is called for each chunk of data
+ * @param arg user data passed to the callback
+ * @return 0 on success, -1 if the file could not be read, or the
+ * non-zero return value of the callback.
+ */
+int fileio_read_all (const char *filename, fileio_cb cb, void *arg) {
+	struct stat st;
+	off_t done = 0;
+	int rv;
+
+	int fd = open(filename, O_RDONLY | O_BINARY);
+	if (fd < 0) return -1;
+
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+#ifdef HAVE_POSIX_FADVISE
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+#ifdef FILEIO_USE_MMAP
+		rv = fileio_read_mmap(fd, st.st_size, cb, arg, &done);
+		if (rv || done >= st.st_size) {
+			close(fd);
+			return rv;
+		}
+		/* mapping failed (or the file grew) - read the rest */
+#endif
+	}
+
+	rv = fileio_read_fd(fd, done, cb, arg);
+	close(fd);
+	return rv;
+}
+
+struct fileio_reader {
+	int fd;
+	off_t start; //< file offset of the first byte to deliver
+	off_t size; //< file offset after the last byte to deliver
+	off_t off;  //< file offset of the next byte
+#ifdef FILEIO_USE_MMAP
+	unsigned char *map; //< current window or NULL
+	off_t map_off;
+	size_t map_len;
+	int use_mmap;
+#endif
+};
+
+/**
+ * open a regular file for sequential reading with \ref fileio_read.
+ *
+ * @param filename the file to read
+ * @param limit maximum number of bytes to read (0: whole file)
+ * @return reader or NULL if the file could not be opened or is not
+ * a regular file.
+ */
+fileio_reader *fileio_open (const char *filename, off_t limit) {
+	return fileio_open_range(filename, 0, limit);
+}
+
+/**
+ * open a part of a regular file for sequential reading with
+ * \ref fileio_read.
+ *
+ * @param filename the file to read
+ * @param offset position of the first byte to read
+ * @param len maximum number of bytes to read (0: up to the end of the file)
+ * @return reader or NULL if the file could not be opened, is not
+ * a regular file or is shorter than offset.
+ */
+fileio_reader *fileio_open_range (const char *filename, off_t offset, off_t len) {
+	fileio_reader *r;
+	struct stat st;
+
+	int fd = open(filename, O_RDONLY | O_BINARY);
+	if (fd < 0) return NULL;
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) || offset < 0 || offset > st.st_size
+			|| lseek(fd, offset, SEEK_SET) != offset) {
+		close(fd);
+		return NULL;
+	}
+#ifdef HAVE_POSIX_FADVISE
+	posix_fadvise(fd, offset, len, POSIX_FADV_SEQUENTIAL);
+#endif
+	r = (fileio_reader*) xcalloc(1, sizeof(fileio_reader));
+	r->fd = fd;
+	r->start = r->off = offset;
+	r->size = st.st_size;
+	if (len > 0 && len < r->size - offset) r->size = offset + len;
+#ifdef FILEIO_USE_MMAP
+	r->use_mmap = 1;
+#endif
+	return r;
+}
+
+/**
+ * @return number of bytes that \ref fileio_read will deliver in total
+ */
+off_t fileio_size (fileio_reader *r) {
+	return r->size - r->start;
+}
+
+/**
+ * copy the next part of the file to buf. Regular files are
+ * mmap()ed window by window, so the data is copied only once,
+ * directly into the caller's buffer.
+ *
+ * @return number of bytes copied, 0 at the end of the file or -1 on error
+ */
+ssize_t fileio_read (fileio_reader *r, void *buf, size_t len) {
+	ssize_t rv;
+	if (r->off >= r->size) return 0;
+	if ((off_t) len > r->size - r->off) len = (size_t) (r->size - r->off);
+
+#ifdef FILEIO_USE_MMAP
+	if (r->use_mmap) {
+		if (!r->map || r->off >= r->map_off + (off_t) r->map_len) {
+			if (r->map) munmap(r->map, r->map_len);
+			r->map_off = r->off - (r->off % FILEIO_MAP_WINDOW);
+			r->map_len = (r->size - r->map_off) > FILEIO_MAP_WINDOW ? FILEIO_MAP_WINDOW : (size_t) (r->size - r->map_off);
+			r->map = (unsigned char*) mmap(NULL, r->map_len, PROT_READ, MAP_SHARED, r->fd, r->map_off);
+			if (r->map == MAP_FAILED) {
+				/* continue with read(2) */
+				r->map = NULL;
+				r->use_mmap = 0;
+				if (lseek(r->fd, r->off, SEEK_SET) != r->off) return -1;
+			}
+#ifdef HAVE_MADVISE
+			else madvise(r->map, r->map_len, MADV_SEQUENTIAL);
+#endif
+		}
+		if (r->map) {
+			size_t avail = r->map_len - (size_t) (r->off - r->map_off);
+			if (len > avail) len = avail;
+			memcpy(buf, r->map + (r->off - r->map_off), len);
+			r->off += len;
+			return len;
+		}
+	}
+#endif
+
+	do {
+		rv = read(r->fd, buf, len);
+	} while (rv < 0 && errno == EINTR);
+	if (rv > 0) r->off += rv;
+	else if (rv == 0) return -1; // file was truncated
+	return rv;
+}
+
+void fileio_close (fileio_reader *r) {
+	if (!r) return;
+#ifdef FILEIO_USE_MMAP
+	if (r->map) munmap(r->map, r->map_len);
+#endif
+	close(r->fd);
+	xfree(r);
+}
+// vi: sts=2 sw=2 ts=2
@@ -0,0 +1,26 @@
+#ifndef _OAUTH_FILEIO_H
+#define _OAUTH_FILEIO_H      1
+
+#include <sys/types.h>
+
+/* Prototypes for functions defined in fileio.c  */
+
+/**
+ * called for each consecutive chunk of the file.
+ * return 0 to continue, any other value aborts the read and
+ * is passed on as return value of \ref fileio_read_all.
+ */
+typedef int (*fileio_cb)(void *arg, const unsigned char *data, size_t len);
+
+int fileio_read_all (const char *filename, fileio_cb cb, void *arg);
+
+/** sequential reader, see \ref fileio_open */
+typedef struct fileio_reader fileio_reader;
+
+fileio_reader *fileio_open (const char *filename, off_t limit);
+fileio_reader *fileio_open_range (const char *filename, off_t offset, off_t len);
+off_t fileio_size (fileio_reader *r);
+ssize_t fileio_read (fileio_reader *r, void *buf, size_t len);
+void fileio_close (fileio_reader *r);
+
+#endif
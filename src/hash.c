@@ -27,10 +27,26 @@
 # include <config.h>
 #endif
 
+#include <string.h>
+#include <limits.h>
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
 #if USE_BUILTIN_HASH // built-in / AVR -- TODO: check license of sha1.c
 #include <stdio.h>
 #include "oauth.h" // oauth_encode_base64
 #include "xmalloc.h"
+#include "fileio.h"
 
 #include "sha1.c" // TODO: sha1.h ; Makefile.am: add sha1.c
 
@@ -47,34 +63,30 @@ char *oauth_sign_hmac_sha1 (const char *m, const char *k) {
 	return(oauth_sign_hmac_sha1_raw (m, strlen(m), k, strlen(k)));
 }
 
-char *oauth_body_hash_file(char *filename) {
-	size_t len=0;
-	char fb[BUFSIZ];
+struct oauth_body_hash_ctx {
 	sha1nfo s;
+};
 
-	FILE *F= fopen(filename, "r");
-
-	if (!F) return NULL;
-	sha1_init(&s);
+oauth_body_hash_ctx *oauth_body_hash_init(void) {
+	oauth_body_hash_ctx *ctx = (oauth_body_hash_ctx*) xmalloc(sizeof(oauth_body_hash_ctx));
+	sha1_init(&ctx->s);
+	return ctx;
+}
 
-	while (!feof(F) && (len=fread(fb,sizeof(char),BUFSIZ, F))>0) {
-		sha1_write(&s, fb, len);
-	}
-	fclose(F);
+int oauth_body_hash_update(oauth_body_hash_ctx *ctx, const void *data, size_t length) {
+	sha1_write(&ctx->s, (const char*) data, length);
+	return 0;
+}
 
+char *oauth_body_hash_final(oauth_body_hash_ctx *ctx) {
 	unsigned char *dgst = xmalloc(HASH_LENGTH*sizeof(char)); // oauth_body_hash_encode frees the digest..
-	memcpy(dgst, sha1_result(&s), HASH_LENGTH);
+	memcpy(dgst, sha1_result(&ctx->s), HASH_LENGTH);
+	xfree(ctx);
 	return oauth_body_hash_encode(HASH_LENGTH, dgst);
 }
 
-char *oauth_body_hash_data(size_t length, const char *data) {
-	sha1nfo s;
-	sha1_init(&s);
-	for (;length--;) sha1_writebyte(&s, *data++);
-
-	unsigned char *dgst = xmalloc(HASH_LENGTH*sizeof(char)); // oauth_body_hash_encode frees the digest..
-	memcpy(dgst, sha1_result(&s), HASH_LENGTH);
-	return oauth_body_hash_encode(HASH_LENGTH, dgst);
+void oauth_body_hash_free(oauth_body_hash_ctx *ctx) {
+	xfree(ctx);
 }
 
 char *oauth_sign_rsa_sha1 (const char *m, const char *k) {
@@ -94,6 +106,7 @@ int oauth_verify_rsa_sha1 (const char *m, const char *c, const char *sig) {
 #include <stdlib.h>
 #include <string.h>
 #include "xmalloc.h"
+#include "fileio.h"
 #include "oauth.h" // oauth base64 encode fn's.
 
 // NSS includes
@@ -264,79 +277,60 @@ looser:
 	return rv;
 }
 
-char *oauth_body_hash_file(char *filename) {
-	PK11SlotInfo  *slot = NULL;
-	PK11Context   *context = NULL;
-	unsigned char  digest[20]; // Is there a way to tell how large the output is?
-	unsigned int   len;
-	SECStatus      s;
-	char          *rv=NULL;
-	size_t         bl;
-	unsigned char  fb[BUFSIZ];
-	unsigned char *dgst;
+struct oauth_body_hash_ctx {
+	PK11Context *context;
+};
 
-	FILE *F= fopen(filename, "r");
-	if (!F) return NULL;
+oauth_body_hash_ctx *oauth_body_hash_init(void) {
+	oauth_body_hash_ctx *ctx;
+	PK11Context *context;
 
 	oauth_init_nss();
 
-	slot = PK11_GetInternalKeySlot();
-	if (!slot) goto looser;
 	context = PK11_CreateDigestContext(SEC_OID_SHA1);
-	if (!context) goto looser;
-
-	s = PK11_DigestBegin(context);
-	if (s != SECSuccess) goto looser;
-	while (!feof(F) && (bl=fread(fb,sizeof(char),BUFSIZ, F))>0) {
-		s = PK11_DigestOp(context, (unsigned char*) fb, bl);
-		if (s != SECSuccess) goto looser;
+	if (!context) return NULL;
+	if (PK11_DigestBegin(context) != SECSuccess) {
+		PK11_DestroyContext(context, PR_TRUE);
+		return NULL;
 	}
-	s = PK11_DigestFinal(context, digest, &len, sizeof digest);
-	if (s != SECSuccess) goto looser;
-
-	dgst = xmalloc(len*sizeof(char)); // oauth_body_hash_encode frees the digest..
-	memcpy(dgst, digest, len);
-	rv=oauth_body_hash_encode(len, dgst);
+	ctx = (oauth_body_hash_ctx*) xmalloc(sizeof(oauth_body_hash_ctx));
+	ctx->context = context;
+	return ctx;
+}
 
-looser:
-	fclose(F);
-	if (context) PK11_DestroyContext(context, PR_TRUE);
-	if (slot) PK11_FreeSlot(slot);
-	return rv;
+int oauth_body_hash_update(oauth_body_hash_ctx *ctx, const void *data, size_t length) {
+	/* PK11_DigestOp takes an unsigned int length */
+	while (length > 0) {
+		unsigned int bl = length > 0x40000000 ? 0x40000000 : (unsigned int) length;
+		if (PK11_DigestOp(ctx->context, (const unsigned char*) data, bl) != SECSuccess) return -1;
+		data = (const unsigned char*) data + bl;
+		length -= bl;
+	}
+	return 0;
 }
 
-char *oauth_body_hash_data(size_t length, const char *data) {
-	PK11SlotInfo  *slot = NULL;
-	PK11Context   *context = NULL;
+char *oauth_body_hash_final(oauth_body_hash_ctx *ctx) {
 	unsigned char  digest[20]; // Is there a way to tell how large the output is?
 	unsigned int   len;
 	SECStatus      s;
 	char          *rv=NULL;
 
-	oauth_init_nss();
-
-	slot = PK11_GetInternalKeySlot();
-	if (!slot) goto looser;
-	context = PK11_CreateDigestContext(SEC_OID_SHA1);
-	if (!context) goto looser;
-
-	s = PK11_DigestBegin(context);
-	if (s != SECSuccess) goto looser;
-	s = PK11_DigestOp(context, (unsigned char*) data, length);
-	if (s != SECSuccess) goto looser;
-	s = PK11_DigestFinal(context, digest, &len, sizeof digest);
-	if (s != SECSuccess) goto looser;
-
-	unsigned char *dgst = xmalloc(len*sizeof(char)); // oauth_body_hash_encode frees the digest..
-	memcpy(dgst, digest, len);
-	rv=oauth_body_hash_encode(len, dgst);
-
-looser:
-	if (context) PK11_DestroyContext(context, PR_TRUE);
-	if (slot) PK11_FreeSlot(slot);
+	s = PK11_DigestFinal(ctx->context, digest, &len, sizeof digest);
+	if (s == SECSuccess) {
+		unsigned char *dgst = xmalloc(len*sizeof(char)); // oauth_body_hash_encode frees the digest..
+		memcpy(dgst, digest, len);
+		rv=oauth_body_hash_encode(len, dgst);
+	}
+	oauth_body_hash_free(ctx);
 	return rv;
 }
 
+void oauth_body_hash_free(oauth_body_hash_ctx *ctx) {
+	if (!ctx) return;
+	PK11_DestroyContext(ctx->context, PR_TRUE);
+	xfree(ctx);
+}
+
 #else
 /* use http://www.openssl.org/ for hash/sign */
 
@@ -361,6 +355,7 @@ looser:
 #include <stdlib.h>
 #include <string.h>
 #include "xmalloc.h"
+#include "fileio.h"
 #include "oauth.h" // base64 encode fn's.
 #include <openssl/hmac.h>
 
@@ -455,40 +450,269 @@ int oauth_verify_rsa_sha1 (const char *m, const char *c, const char *s) {
 /**
  * http://oauth.googlecode.com/svn/spec/ext/body_hash/1.0/oauth-bodyhash.html
  */
-char *oauth_body_hash_file(char *filename) {
-	unsigned char fb[BUFSIZ];
-	EVP_MD_CTX ctx;
-	size_t len=0;
+struct oauth_body_hash_ctx {
+	EVP_MD_CTX *md_ctx;
+};
+
+oauth_body_hash_ctx *oauth_body_hash_init(void) {
+	oauth_body_hash_ctx *ctx;
+	EVP_MD_CTX *md_ctx = EVP_MD_CTX_create();
+	if (!md_ctx) return NULL;
+	if (!EVP_DigestInit_ex(md_ctx, EVP_sha1(), NULL)) {
+		EVP_MD_CTX_destroy(md_ctx);
+		return NULL;
+	}
+	ctx = (oauth_body_hash_ctx*) xmalloc(sizeof(oauth_body_hash_ctx));
+	ctx->md_ctx = md_ctx;
+	return ctx;
+}
+
+int oauth_body_hash_update(oauth_body_hash_ctx *ctx, const void *data, size_t length) {
+	return EVP_DigestUpdate(ctx->md_ctx, data, length) ? 0 : -1;
+}
+
+char *oauth_body_hash_final(oauth_body_hash_ctx *ctx) {
+	unsigned int len=0;
 	unsigned char *md;
-	FILE *F= fopen(filename, "r");
-	if (!F) return NULL;
+	char *rv=NULL;
+	md=(unsigned char*) xcalloc(EVP_MAX_MD_SIZE,sizeof(unsigned char));
+	if (EVP_DigestFinal_ex(ctx->md_ctx, md, &len)) {
+		rv=oauth_body_hash_encode(len, md);
+	} else {
+		xfree(md);
+	}
+	oauth_body_hash_free(ctx);
+	return rv;
+}
+
+void oauth_body_hash_free(oauth_body_hash_ctx *ctx) {
+	if (!ctx) return;
+	EVP_MD_CTX_destroy(ctx->md_ctx);
+	xfree(ctx);
+}
+
+#endif
+
+/* backend independent wrappers */
+
+static int oauth_body_hash_file_cb(void *arg, const unsigned char *data, size_t len) {
+	return oauth_body_hash_update((oauth_body_hash_ctx*) arg, data, len);
+}
 
-	EVP_MD_CTX_init(&ctx);
-	EVP_DigestInit(&ctx,EVP_sha1());
-	while (!feof(F) && (len=fread(fb,sizeof(char),BUFSIZ, F))>0) {
-		EVP_DigestUpdate(&ctx, fb, len);
+char *oauth_body_hash_file(char *filename) {
+	oauth_body_hash_ctx *ctx = oauth_body_hash_init();
+	if (!ctx) return NULL;
+	if (fileio_read_all(filename, oauth_body_hash_file_cb, ctx)) {
+		oauth_body_hash_free(ctx);
+		return NULL;
 	}
-	fclose(F);
-	len=0;
-	md=(unsigned char*) xcalloc(EVP_MD_size(EVP_sha1()),sizeof(unsigned char));
-	EVP_DigestFinal(&ctx, md,(unsigned int*) &len);
-	EVP_MD_CTX_cleanup(&ctx);
-	return oauth_body_hash_encode(len, md);
+	return oauth_body_hash_final(ctx);
 }
 
 char *oauth_body_hash_data(size_t length, const char *data) {
-	EVP_MD_CTX ctx;
-	size_t len=0;
-	unsigned char *md;
-	md=(unsigned char*) xcalloc(EVP_MD_size(EVP_sha1()),sizeof(unsigned char));
-	EVP_MD_CTX_init(&ctx);
-	EVP_DigestInit(&ctx,EVP_sha1());
-	EVP_DigestUpdate(&ctx, data, length);
-	EVP_DigestFinal(&ctx, md,(unsigned int*) &len);
-	EVP_MD_CTX_cleanup(&ctx);
-	return oauth_body_hash_encode(len, md);
+	oauth_body_hash_ctx *ctx = oauth_body_hash_init();
+	if (!ctx) return NULL;
+	if (oauth_body_hash_update(ctx, data, length)) {
+		oauth_body_hash_free(ctx);
+		return NULL;
+	}
+	return oauth_body_hash_final(ctx);
+}
+
+char *oauth_body_hash_iov(const struct iovec *iov, int iovcnt) {
+	int i;
+	oauth_body_hash_ctx *ctx = oauth_body_hash_init();
+	if (!ctx) return NULL;
+	for (i=0; i<iovcnt; i++) {
+		if (oauth_body_hash_update(ctx, iov[i].iov_base, iov[i].iov_len)) {
+			oauth_body_hash_free(ctx);
+			return NULL;
+		}
+	}
+	return oauth_body_hash_final(ctx);
+}
+
+#ifdef HAVE_ZLIB
+
+#define OAUTH_GZIP_CHUNK (256*1024)
+
+/* state of a streaming gzip compression with body hash over the output */
+struct oauth_gzip_state {
+	z_stream zs;
+	oauth_body_hash_ctx *hash;
+	unsigned char *out;
+	size_t len;
+	size_t alloc;
+};
+
+/**
+ * compress all input in zs.next_in/avail_in (flush: Z_NO_FLUSH or
+ * Z_FINISH) and hash the new output.
+ */
+static int oauth_gzip_run(struct oauth_gzip_state *st, int flush) {
+	int rv;
+	do {
+		unsigned char *start;
+		size_t avail;
+		if (st->len == st->alloc) {
+			st->alloc *= 2;
+			st->out = (unsigned char*) xrealloc(st->out, st->alloc);
+		}
+		start = st->out + st->len;
+		avail = st->alloc - st->len;
+		if (avail > UINT_MAX) avail = UINT_MAX; // avail_out is 32bit
+		st->zs.next_out = start;
+		st->zs.avail_out = (uInt) avail;
+		rv = deflate(&st->zs, flush);
+		if (rv == Z_STREAM_ERROR) return -1;
+		avail = st->zs.next_out - start; // bytes produced
+		if (st->hash && oauth_body_hash_update(st->hash, start, avail))
+			return -1;
+		st->len += avail;
+	} while (st->zs.avail_in > 0 || (flush == Z_FINISH && rv != Z_STREAM_END));
+	return 0;
+}
+
+static int oauth_gzip_cb(void *arg, const unsigned char *data, size_t len) {
+	struct oauth_gzip_state *st = (struct oauth_gzip_state*) arg;
+	while (len > 0) {
+		size_t n = len > OAUTH_GZIP_CHUNK ? OAUTH_GZIP_CHUNK : len;
+		st->zs.next_in = (unsigned char*) data;
+		st->zs.avail_in = n;
+		if (oauth_gzip_run(st, Z_NO_FLUSH)) return -1;
+		data += n; len -= n;
+	}
+	return 0;
+}
+
+static int oauth_gzip_init(struct oauth_gzip_state *st, size_t hint, int hash) {
+	memset(st, 0, sizeof(*st));
+	// windowBits 15 + 16: gzip wrapper
+	if (deflateInit2(&st->zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return -1;
+	if (hash && !(st->hash = oauth_body_hash_init())) {
+		deflateEnd(&st->zs);
+		return -1;
+	}
+	st->alloc = hint / 4 + 1024;
+	st->out = (unsigned char*) xmalloc(st->alloc);
+	return 0;
+}
+
+static char *oauth_gzip_finish(struct oauth_gzip_state *st, int ok, size_t *gzlen, char **body_hash) {
+	if (ok && oauth_gzip_run(st, Z_FINISH)) ok = 0;
+	deflateEnd(&st->zs);
+	if (st->hash) {
+		if (ok) {
+			*body_hash = oauth_body_hash_final(st->hash);
+			if (!*body_hash) ok = 0;
+		} else oauth_body_hash_free(st->hash);
+	}
+	if (!ok) {
+		xfree(st->out);
+		return NULL;
+	}
+	if (gzlen) *gzlen = st->len;
+	return (char*) st->out;
+}
+
+char *oauth_body_gzip(const char *data, size_t len, size_t *gzlen, char **body_hash) {
+	struct oauth_gzip_state st;
+	if (!data || oauth_gzip_init(&st, len, body_hash != NULL)) return NULL;
+	return oauth_gzip_finish(&st, !oauth_gzip_cb(&st, (const unsigned char*) data, len), gzlen, body_hash);
+}
+
+char *oauth_body_gzip_file(const char *filename, size_t *gzlen, char **body_hash) {
+	struct oauth_gzip_state st;
+	if (oauth_gzip_init(&st, 0, body_hash != NULL)) return NULL;
+	return oauth_gzip_finish(&st, !fileio_read_all(filename, oauth_gzip_cb, &st), gzlen, body_hash);
 }
 
+#else // no zlib
+
+char *oauth_body_gzip(const char *data, size_t len, size_t *gzlen, char **body_hash) { return NULL; }
+char *oauth_body_gzip_file(const char *filename, size_t *gzlen, char **body_hash) { return NULL; }
+
 #endif
 
+struct oauth_body_hash_job {
+	int n;
+	const char **filenames;
+	char **results;
+	int next; //< next file to process
+	int failed;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t lock;
+#endif
+};
+
+static void *oauth_body_hash_files_worker(void *arg) {
+	struct oauth_body_hash_job *job = (struct oauth_body_hash_job*) arg;
+	for (;;) {
+		int i;
+#ifdef HAVE_PTHREAD
+		pthread_mutex_lock(&job->lock);
+#endif
+		i = job->next++;
+#ifdef HAVE_PTHREAD
+		pthread_mutex_unlock(&job->lock);
+#endif
+		if (i >= job->n) break;
+		job->results[i] = oauth_body_hash_file((char*) job->filenames[i]);
+		if (!job->results[i]) {
+#ifdef HAVE_PTHREAD
+			pthread_mutex_lock(&job->lock);
+#endif
+			job->failed++;
+#ifdef HAVE_PTHREAD
+			pthread_mutex_unlock(&job->lock);
+#endif
+		}
+	}
+	return NULL;
+}
+
+int oauth_body_hash_files(int n, const char **filenames, char **results, int nthreads) {
+	struct oauth_body_hash_job job;
+	job.n = n;
+	job.filenames = filenames;
+	job.results = results;
+	job.next = 0;
+	job.failed = 0;
+
+#ifdef HAVE_PTHREAD
+	pthread_t *threads = NULL;
+	int i, started = 0;
+
+	if (nthreads <= 0) {
+#ifdef _SC_NPROCESSORS_ONLN
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+		if (nthreads <= 0) nthreads = 1;
+	}
+	if (nthreads > n) nthreads = n;
+
+	pthread_mutex_init(&job.lock, NULL);
+	if (nthreads > 1) {
+		// initialize the hash backend (NSS) before going parallel
+		oauth_body_hash_free(oauth_body_hash_init());
+		// the calling thread is one of the workers
+		threads = (pthread_t*) xmalloc((nthreads-1) * sizeof(pthread_t));
+		for (i=0; i<nthreads-1; i++) {
+			if (pthread_create(&threads[started], NULL, oauth_body_hash_files_worker, &job)) break;
+			started++;
+		}
+	}
+	oauth_body_hash_files_worker(&job);
+	for (i=0; i<started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	xfree(threads);
+	pthread_mutex_destroy(&job.lock);
+#else
+	oauth_body_hash_files_worker(&job);
+#endif
+	return job.failed;
+}
+
 // vi: sts=2 sw=2 ts=2
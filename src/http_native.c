@@ -0,0 +1,768 @@
+/* http_native.c -- minimal HTTP/1.1 client, used if libcurl is not available
+ *
+ * Copyright 2026 The liboauth contributors (see git log)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifdef HAVE_NATIVE_HTTP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
+#ifdef HAVE_NATIVE_TLS
+# include <signal.h>
+# include <openssl/ssl.h>
+# include <openssl/err.h>
+#endif
+
+#include "xmalloc.h"
+#include "http_native.h"
+
+#define NHTTP_USER_AGENT "liboauth-agent/" VERSION
+
+/* receive buffer size per connection */
+#define NHTTP_BUFSIZ (16*1024)
+/* number of keep-alive connections that are kept open */
+#define NHTTP_MAX_IDLE 8
+/* longest status- or header-line that is accepted */
+#define NHTTP_MAX_LINE (64*1024)
+/* largest reply body that is accepted */
+#define NHTTP_MAX_BODY (1024*1024*1024)
+
+#ifndef MSG_NOSIGNAL
+# define MSG_NOSIGNAL 0
+#endif
+#ifndef MSG_MORE
+# define MSG_MORE 0
+#endif
+
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t nhttp_lock = PTHREAD_MUTEX_INITIALIZER;
+# define NHTTP_LOCK   pthread_mutex_lock(&nhttp_lock)
+# define NHTTP_UNLOCK pthread_mutex_unlock(&nhttp_lock)
+#else
+# define NHTTP_LOCK
+# define NHTTP_UNLOCK
+#endif
+
+struct nhttp_url {
+	int tls;
+	char *host;    //< host name or address (without brackets)
+	char *port;
+	char *path;    //< path and query
+	char *hosthdr; //< value of the Host: header
+	char *origin;  //< scheme://host:port - key for connection re-use
+};
+
+typedef struct {
+	int fd;
+#ifdef HAVE_NATIVE_TLS
+	SSL *ssl;
+#endif
+	char *origin;
+	char buf[NHTTP_BUFSIZ];
+	size_t pos, len; //< unread data in buf
+} nhttp_conn;
+
+struct nhttp_buf {
+	char *data;
+	size_t size;
+	size_t alloc;
+};
+
+static nhttp_conn *nhttp_idle[NHTTP_MAX_IDLE];
+static int nhttp_n_idle = 0;
+
+/* growable buffer */
+
+/**
+ * make room for len more bytes (and a terminating NUL).
+ * @return 0 on success, -1 if the size would overflow
+ */
+static int nhttp_buf_reserve(struct nhttp_buf *b, size_t len) {
+	size_t need, alloc;
+	if (len > SIZE_MAX - b->size - 1) return -1;
+	need = b->size + len + 1;
+	if (need <= b->alloc) return 0;
+	alloc = b->alloc ? b->alloc : 1024;
+	while (alloc < need) {
+		if (alloc > SIZE_MAX / 2) {
+			alloc = need;
+			break;
+		}
+		alloc *= 2;
+	}
+	b->data = (char*) xrealloc(b->data, alloc);
+	b->alloc = alloc;
+	return 0;
+}
+
+static int nhttp_buf_append(struct nhttp_buf *b, const char *data, size_t len) {
+	if (nhttp_buf_reserve(b, len)) return -1;
+	memcpy(b->data + b->size, data, len);
+	b->size += len;
+	b->data[b->size] = '\0';
+	return 0;
+}
+
+static void nhttp_buf_printf(struct nhttp_buf *b, const char *fmt, const char *arg) {
+	if (nhttp_buf_reserve(b, strlen(fmt) + strlen(arg))) return;
+	b->size += sprintf(b->data + b->size, fmt, arg);
+}
+
+/* URL parsing */
+
+static void nhttp_url_free(struct nhttp_url *url) {
+	xfree(url->host);
+	xfree(url->port);
+	xfree(url->path);
+	xfree(url->hosthdr);
+	xfree(url->origin);
+}
+
+static char *nhttp_strndup(const char *s, size_t len) {
+	char *rv = (char*) xmalloc(len + 1);
+	memcpy(rv, s, len);
+	rv[len] = '\0';
+	return rv;
+}
+
+static int nhttp_parse_url(const char *u, struct nhttp_url *url) {
+	const char *p, *end, *at, *port = NULL;
+	size_t hlen;
+
+	memset(url, 0, sizeof(struct nhttp_url));
+	if (!strncasecmp(u, "http://", 7)) {
+		p = u + 7;
+	} else if (!strncasecmp(u, "https://", 8)) {
+		p = u + 8;
+		url->tls = 1;
+	} else {
+		return -1;
+	}
+	end = p + strcspn(p, "/?#");
+	/* skip user-info */
+	for (at = p; at < end; at++) {
+		if (*at == '@') p = at + 1;
+	}
+
+	if (*p == '[') {
+		const char *close = memchr(p, ']', end - p);
+		if (!close) return -1;
+		url->host = nhttp_strndup(p + 1, close - p - 1);
+		if (close[1] == ':') port = close + 2;
+		hlen = close + 1 - p;
+	} else {
+		const char *colon = memchr(p, ':', end - p);
+		hlen = colon ? (size_t) (colon - p) : (size_t) (end - p);
+		url->host = nhttp_strndup(p, hlen);
+		if (colon) port = colon + 1;
+	}
+	if (!*url->host) {
+		nhttp_url_free(url);
+		return -1;
+	}
+
+	if (port && port < end) {
+		url->port = nhttp_strndup(port, end - port);
+		url->hosthdr = nhttp_strndup(p, end - p);
+	} else {
+		url->port = xstrdup(url->tls ? "443" : "80");
+		url->hosthdr = nhttp_strndup(p, hlen);
+	}
+
+	if (*end == '/') {
+		url->path = nhttp_strndup(end, strcspn(end, "#"));
+	} else {
+		size_t len = strcspn(end, "#");
+		url->path = (char*) xmalloc(len + 2);
+		url->path[0] = '/';
+		memcpy(url->path + 1, end, len);
+		url->path[len + 1] = '\0';
+	}
+
+	url->origin = (char*) xmalloc(strlen(url->host) + strlen(url->port) + 12);
+	sprintf(url->origin, "%s://%s:%s", url->tls ? "https" : "http", url->host, url->port);
+	return 0;
+}
+
+/* TLS */
+
+#ifdef HAVE_NATIVE_TLS
+static SSL_CTX *nhttp_ssl_ctx = NULL;
+
+/* OpenSSL writes to the socket with write(2): on a connection the
+ * peer has reset, that raises SIGPIPE, which terminates programs that
+ * do not handle it before the error can be dealt with. Unless the
+ * socket can be told not to (SO_NOSIGPIPE), SIGPIPE is blocked in the
+ * calling thread during each TLS call, and one raised by the call is
+ * consumed before the signal mask is restored.
+ */
+#ifndef SO_NOSIGPIPE
+# ifdef HAVE_PTHREAD
+#  define NHTTP_SIGMASK pthread_sigmask
+# else
+#  define NHTTP_SIGMASK sigprocmask
+# endif
+
+struct nhttp_nosig {
+	sigset_t old;
+	int pending; //< a SIGPIPE was pending before the call
+};
+
+static void nhttp_nosig_begin(struct nhttp_nosig *ns) {
+	sigset_t set, pending;
+	sigemptyset(&set);
+	sigaddset(&set, SIGPIPE);
+	sigemptyset(&pending);
+	sigpending(&pending);
+	ns->pending = sigismember(&pending, SIGPIPE) == 1;
+	NHTTP_SIGMASK(SIG_BLOCK, &set, &ns->old);
+}
+
+static void nhttp_nosig_end(struct nhttp_nosig *ns) {
+	sigset_t set, pending;
+	int sig;
+	sigemptyset(&pending);
+	sigpending(&pending);
+	if (!ns->pending && sigismember(&pending, SIGPIPE) == 1) {
+		sigemptyset(&set);
+		sigaddset(&set, SIGPIPE);
+		sigwait(&set, &sig); // returns at once, it is pending
+	}
+	NHTTP_SIGMASK(SIG_SETMASK, &ns->old, NULL);
+}
+#else
+struct nhttp_nosig {
+	int unused;
+};
+# define nhttp_nosig_begin(ns) (void) (ns)
+# define nhttp_nosig_end(ns) (void) (ns)
+#endif
+
+/**
+ * create the TLS context on first use. Like the libcurl transport
+ * it honours the CURLOPT_CAINFO and CURLOPT_SSL_VERIFYPEER
+ * environment variables.
+ */
+static SSL_CTX *nhttp_tls_ctx(void) {
+	SSL_CTX *ctx;
+	NHTTP_LOCK;
+	if (!nhttp_ssl_ctx) {
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+		SSL_library_init();
+		SSL_load_error_strings();
+		nhttp_ssl_ctx = SSL_CTX_new(SSLv23_client_method());
+#else
+		nhttp_ssl_ctx = SSL_CTX_new(TLS_client_method());
+#endif
+		if (nhttp_ssl_ctx) {
+			int verify = 1;
+			SSL_CTX_set_options(nhttp_ssl_ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3);
+			SSL_CTX_set_default_verify_paths(nhttp_ssl_ctx);
+			if (getenv("CURLOPT_CAINFO"))
+				SSL_CTX_load_verify_locations(nhttp_ssl_ctx, getenv("CURLOPT_CAINFO"), NULL);
+			if (getenv("CURLOPT_SSL_VERIFYPEER") && atol(getenv("CURLOPT_SSL_VERIFYPEER")) == 0)
+				verify = 0;
+			SSL_CTX_set_verify(nhttp_ssl_ctx, verify ? SSL_VERIFY_PEER : SSL_VERIFY_NONE, NULL);
+		}
+	}
+	ctx = nhttp_ssl_ctx;
+	NHTTP_UNLOCK;
+	return ctx;
+}
+
+static int nhttp_tls_connect(nhttp_conn *c, const char *host) {
+	SSL_CTX *ctx = nhttp_tls_ctx();
+	struct nhttp_nosig ns;
+	int rv;
+	if (!ctx) return -1;
+	c->ssl = SSL_new(ctx);
+	if (!c->ssl) return -1;
+	SSL_set_fd(c->ssl, c->fd);
+	SSL_set_tlsext_host_name(c->ssl, host);
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	SSL_set1_host(c->ssl, host);
+#endif
+	nhttp_nosig_begin(&ns);
+	rv = SSL_connect(c->ssl);
+	nhttp_nosig_end(&ns);
+	return rv == 1 ? 0 : -1;
+}
+#endif
+
+/* connections */
+
+static void nhttp_conn_close(nhttp_conn *c) {
+	if (!c) return;
+#ifdef HAVE_NATIVE_TLS
+	if (c->ssl) {
+		struct nhttp_nosig ns;
+		nhttp_nosig_begin(&ns);
+		SSL_shutdown(c->ssl);
+		nhttp_nosig_end(&ns);
+		SSL_free(c->ssl);
+	}
+#endif
+	if (c->fd >= 0) close(c->fd);
+	xfree(c->origin);
+	xfree(c);
+}
+
+static nhttp_conn *nhttp_conn_open(struct nhttp_url *url) {
+	struct addrinfo hints, *res = NULL, *ai;
+	nhttp_conn *c;
+	int fd = -1, one = 1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(url->host, url->port, &hints, &res)) return NULL;
+	for (ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0) continue;
+		if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	if (fd < 0) return NULL;
+
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+#ifdef SO_NOSIGPIPE
+	setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+#ifdef OAUTH_CURL_TIMEOUT
+	{
+		struct timeval tv;
+		tv.tv_sec = OAUTH_CURL_TIMEOUT;
+		tv.tv_usec = 0;
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	}
+#endif
+
+	c = (nhttp_conn*) xcalloc(1, sizeof(nhttp_conn));
+	c->fd = fd;
+	c->origin = xstrdup(url->origin);
+	if (url->tls) {
+#ifdef HAVE_NATIVE_TLS
+		if (nhttp_tls_connect(c, url->host) == 0) return c;
+#endif
+		nhttp_conn_close(c);
+		return NULL;
+	}
+	return c;
+}
+
+/**
+ * take an idle keep-alive connection to the given origin.
+ */
+static nhttp_conn *nhttp_conn_get(const char *origin) {
+	nhttp_conn *c = NULL;
+	int i;
+	NHTTP_LOCK;
+	for (i = nhttp_n_idle - 1; i >= 0; i--) {
+		if (!strcmp(nhttp_idle[i]->origin, origin)) {
+			c = nhttp_idle[i];
+			nhttp_idle[i] = nhttp_idle[--nhttp_n_idle];
+			break;
+		}
+	}
+	NHTTP_UNLOCK;
+	return c;
+}
+
+static void nhttp_conn_put(nhttp_conn *c) {
+	nhttp_conn *drop = NULL;
+	c->pos = c->len = 0;
+	NHTTP_LOCK;
+	if (nhttp_n_idle == NHTTP_MAX_IDLE) {
+		/* close the oldest one */
+		drop = nhttp_idle[0];
+		memmove(&nhttp_idle[0], &nhttp_idle[1], (NHTTP_MAX_IDLE - 1) * sizeof(nhttp_conn*));
+		nhttp_n_idle--;
+	}
+	nhttp_idle[nhttp_n_idle++] = c;
+	NHTTP_UNLOCK;
+	nhttp_conn_close(drop);
+}
+
+/* I/O */
+
+static ssize_t nhttp_io_read(nhttp_conn *c, void *buf, size_t len) {
+	ssize_t rv;
+#ifdef HAVE_NATIVE_TLS
+	if (c->ssl) {
+		struct nhttp_nosig ns;
+		nhttp_nosig_begin(&ns); // a read may write, too
+		rv = SSL_read(c->ssl, buf, len > 0x7fffffff ? 0x7fffffff : (int) len);
+		nhttp_nosig_end(&ns);
+		return rv > 0 ? rv : (SSL_get_error(c->ssl, rv) == SSL_ERROR_ZERO_RETURN ? 0 : -1);
+	}
+#endif
+	do {
+		rv = recv(c->fd, buf, len, 0);
+	} while (rv < 0 && errno == EINTR);
+	return rv;
+}
+
+static int nhttp_io_write(nhttp_conn *c, const char *buf, size_t len, int more) {
+	while (len > 0) {
+		ssize_t rv;
+#ifdef HAVE_NATIVE_TLS
+		if (c->ssl) {
+			struct nhttp_nosig ns;
+			nhttp_nosig_begin(&ns);
+			rv = SSL_write(c->ssl, buf, len > 0x7fffffff ? 0x7fffffff : (int) len);
+			nhttp_nosig_end(&ns);
+			if (rv <= 0) return -1;
+		} else
+#endif
+		{
+			rv = send(c->fd, buf, len, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+			if (rv < 0) {
+				if (errno == EINTR) continue;
+				return -1;
+			}
+		}
+		buf += rv;
+		len -= rv;
+	}
+	return 0;
+}
+
+/**
+ * make sure there is unread data in the receive buffer.
+ * @return 1 if data is available, 0 on EOF, -1 on error
+ */
+static int nhttp_fill(nhttp_conn *c) {
+	ssize_t rv;
+	if (c->pos < c->len) return 1;
+	rv = nhttp_io_read(c, c->buf, NHTTP_BUFSIZ);
+	if (rv <= 0) return (int) rv;
+	c->pos = 0;
+	c->len = rv;
+	return 1;
+}
+
+/**
+ * read a CRLF (or LF) terminated line.
+ * @return the line without line-ending (to be freed), or NULL on EOF or error
+ */
+static char *nhttp_getline(nhttp_conn *c) {
+	struct nhttp_buf line = { NULL, 0, 0 };
+	for (;;) {
+		char *nl;
+		size_t n;
+		if (nhttp_fill(c) <= 0 || line.size > NHTTP_MAX_LINE) {
+			xfree(line.data);
+			return NULL;
+		}
+		nl = memchr(c->buf + c->pos, '\n', c->len - c->pos);
+		n = nl ? (size_t) (nl - (c->buf + c->pos)) : c->len - c->pos;
+		nhttp_buf_append(&line, c->buf + c->pos, n);
+		c->pos += n;
+		if (nl) {
+			c->pos++;
+			break;
+		}
+	}
+	if (line.size > 0 && line.data[line.size - 1] == '\r') line.data[--line.size] = '\0';
+	if (!line.data) nhttp_buf_append(&line, "", 0);
+	return line.data;
+}
+
+/**
+ * append exactly len bytes of the body to out. Large bodies are
+ * received directly into the output buffer. The buffer grows with
+ * the data that arrives, not with the length the server announced.
+ */
+static int nhttp_read_body(nhttp_conn *c, struct nhttp_buf *out, size_t len) {
+	if (len > NHTTP_MAX_BODY || out->size > NHTTP_MAX_BODY - len) return -1;
+	while (len > 0) {
+		size_t n;
+		if (nhttp_buf_reserve(out, len < NHTTP_BUFSIZ ? len : NHTTP_BUFSIZ)) return -1;
+		if (c->pos == c->len && len >= NHTTP_BUFSIZ) {
+			ssize_t rv;
+			n = out->alloc - out->size - 1;
+			if (n > len) n = len;
+			rv = nhttp_io_read(c, out->data + out->size, n);
+			if (rv <= 0) return -1;
+			out->size += rv;
+			len -= rv;
+			continue;
+		}
+		if (nhttp_fill(c) <= 0) return -1;
+		n = c->len - c->pos;
+		if (n > len) n = len;
+		memcpy(out->data + out->size, c->buf + c->pos, n);
+		c->pos += n;
+		out->size += n;
+		len -= n;
+	}
+	if (out->data) out->data[out->size] = '\0';
+	return 0;
+}
+
+static int nhttp_read_until_eof(nhttp_conn *c, struct nhttp_buf *out) {
+	int rv;
+	while ((rv = nhttp_fill(c)) > 0) {
+		if (out->size + (c->len - c->pos) > NHTTP_MAX_BODY
+				|| nhttp_buf_append(out, c->buf + c->pos, c->len - c->pos))
+			return -1;
+		c->pos = c->len;
+	}
+	return rv;
+}
+
+static int nhttp_read_chunked(nhttp_conn *c, struct nhttp_buf *out) {
+	for (;;) {
+		char *line = nhttp_getline(c);
+		char *endp;
+		unsigned long len;
+		if (!line) return -1;
+		errno = 0;
+		len = strtoul(line, &endp, 16);
+		if (endp == line || errno || len > NHTTP_MAX_BODY) {
+			xfree(line);
+			return -1;
+		}
+		xfree(line);
+		if (len == 0) break;
+		if (nhttp_read_body(c, out, len)) return -1;
+		line = nhttp_getline(c); // CRLF after the chunk
+		if (!line) return -1;
+		xfree(line);
+	}
+	/* skip trailers */
+	for (;;) {
+		char *line = nhttp_getline(c);
+		if (!line) return -1;
+		if (!*line) {
+			xfree(line);
+			break;
+		}
+		xfree(line);
+	}
+	return 0;
+}
+
+static int nhttp_header_is(const char *line, const char *name) {
+	size_t len = strlen(name);
+	return !strncasecmp(line, name, len) && line[len] == ':';
+}
+
+static const char *nhttp_header_value(const char *line) {
+	const char *v = strchr(line, ':') + 1;
+	while (*v == ' ' || *v == '\t') v++;
+	return v;
+}
+
+/**
+ * read the response to a request.
+ *
+ * @param head 1 if the request was a HEAD request (no body)
+ * @param received set to 1 as soon as any data was received
+ * @return 0 on success, -1 on error
+ */
+static int nhttp_read_response(nhttp_conn *c, int head, struct nhttp_buf *out, long *status, int *keepalive, int *received) {
+	char *line;
+	int chunked, minor, bad;
+	long long clen;
+
+	*received = 0;
+	for (;;) {
+		line = nhttp_getline(c);
+		if (!line) return -1;
+		*received = 1;
+		if (sscanf(line, "HTTP/1.%d %ld", &minor, status) != 2) {
+			xfree(line);
+			return -1;
+		}
+		xfree(line);
+
+		chunked = bad = 0;
+		clen = -1;
+		*keepalive = minor > 0;
+		while ((line = nhttp_getline(c)) && *line) {
+			if (nhttp_header_is(line, "Content-Length")) {
+				const char *v = nhttp_header_value(line);
+				char *endp;
+				errno = 0;
+				clen = strtoll(v, &endp, 10);
+				if (endp == v || errno || clen < 0 || clen > NHTTP_MAX_BODY) bad = 1;
+			} else if (nhttp_header_is(line, "Transfer-Encoding")) {
+				if (strstr(nhttp_header_value(line), "chunked")) chunked = 1;
+			} else if (nhttp_header_is(line, "Connection")) {
+				const char *v = nhttp_header_value(line);
+				if (!strncasecmp(v, "close", 5)) *keepalive = 0;
+				else if (!strncasecmp(v, "keep-alive", 10)) *keepalive = 1;
+			}
+			xfree(line);
+		}
+		if (!line) return -1;
+		xfree(line);
+		if (bad) return -1;
+		/* skip interim responses (100 Continue) */
+		if (*status >= 100 && *status < 200 && *status != 101) continue;
+		break;
+	}
+
+	if (head || *status == 204 || *status == 304 || (*status >= 100 && *status < 200))
+		return 0;
+	if (chunked)
+		return nhttp_read_chunked(c, out);
+	if (clen >= 0)
+		return nhttp_read_body(c, out, (size_t) clen);
+	/* no length given: the body ends with the connection */
+	*keepalive = 0;
+	return nhttp_read_until_eof(c, out);
+}
+
+/* public */
+
+/**
+ * check if the built-in client can handle the URL:
+ * http always, https only if compiled with TLS support.
+ */
+int nhttp_supported (const char *url) {
+	if (!strncasecmp(url, "http://", 7)) return 1;
+#ifdef HAVE_NATIVE_TLS
+	if (!strncasecmp(url, "https://", 8)) return 1;
+#endif
+	return 0;
+}
+
+/**
+ * perform a HTTP request. Connections are kept open for re-use
+ * if the server permits.
+ *
+ * @param method HTTP verb
+ * @param url URL to query
+ * @param customheader additional header(s) separated by "\r\n" or NULL
+ * @param body request body or NULL
+ * @param len length of body in bytes
+ * @param status if not NULL, the HTTP status code is stored here
+ * @return the reply body (to be freed by the caller) or NULL on error
+ */
+char *nhttp_request (const char *method, const char *url, const char *customheader, const char *body, size_t len, long *status) {
+	struct nhttp_url u;
+	struct nhttp_buf req = { NULL, 0, 0 };
+	struct nhttp_buf out = { NULL, 0, 0 };
+	int head = !strcmp(method, "HEAD");
+	int attempt, ok = 0;
+	long code = 0;
+
+	if (nhttp_parse_url(url, &u)) return NULL;
+
+	nhttp_buf_printf(&req, "%s ", method);
+	nhttp_buf_printf(&req, "%s HTTP/1.1\r\n", u.path);
+	nhttp_buf_printf(&req, "Host: %s\r\n", u.hosthdr);
+	nhttp_buf_printf(&req, "User-Agent: %s\r\nAccept: */*\r\n", NHTTP_USER_AGENT);
+	if (customheader && *customheader) {
+		size_t hl = strlen(customheader);
+		nhttp_buf_append(&req, customheader, hl);
+		if (hl < 2 || strcmp(customheader + hl - 2, "\r\n"))
+			nhttp_buf_append(&req, "\r\n", 2);
+	}
+	if (body || !strcmp(method, "POST") || !strcmp(method, "PUT")) {
+		char tmp[32];
+		snprintf(tmp, sizeof(tmp), "%lu", (unsigned long) len);
+		nhttp_buf_printf(&req, "Content-Length: %s\r\n", tmp);
+		if (!customheader || !(strstr(customheader, "Content-Type:") || strstr(customheader, "content-type:")))
+			nhttp_buf_printf(&req, "Content-Type: %s\r\n", "application/x-www-form-urlencoded");
+	}
+	nhttp_buf_append(&req, "\r\n", 2);
+
+	/* a kept-alive connection may have been closed by the server
+	 * in the meantime: retry once with a new one if nothing was
+	 * received. */
+	for (attempt = 0; attempt < 2 && !ok; attempt++) {
+		int keepalive = 0, received = 0;
+		nhttp_conn *c = attempt == 0 ? nhttp_conn_get(u.origin) : NULL;
+		int reused = c != NULL;
+		if (!c) c = nhttp_conn_open(&u);
+		if (!c) break;
+
+		out.size = 0;
+		if (nhttp_io_write(c, req.data, req.size, body && len > 0)
+				|| (body && len > 0 && nhttp_io_write(c, body, len, 0))
+				|| nhttp_read_response(c, head, &out, &code, &keepalive, &received)) {
+			nhttp_conn_close(c);
+			if (reused && !received) continue;
+			break;
+		}
+		ok = 1;
+		if (keepalive) nhttp_conn_put(c);
+		else nhttp_conn_close(c);
+	}
+
+	xfree(req.data);
+	nhttp_url_free(&u);
+	if (status) *status = code;
+	if (!ok) {
+		xfree(out.data);
+		return NULL;
+	}
+	if (!out.data) nhttp_buf_append(&out, "", 0);
+	return out.data;
+}
+
+/**
+ * close all kept-alive connections.
+ */
+void nhttp_cleanup (void) {
+	NHTTP_LOCK;
+	while (nhttp_n_idle > 0) {
+		nhttp_conn_close(nhttp_idle[--nhttp_n_idle]);
+	}
+#ifdef HAVE_NATIVE_TLS
+	if (nhttp_ssl_ctx) {
+		SSL_CTX_free(nhttp_ssl_ctx);
+		nhttp_ssl_ctx = NULL;
+	}
+#endif
+	NHTTP_UNLOCK;
+}
+
+#endif // HAVE_NATIVE_HTTP
+// vi: sts=2 sw=2 ts=2
@@ -0,0 +1,10 @@
+#ifndef _OAUTH_HTTP_NATIVE_H
+#define _OAUTH_HTTP_NATIVE_H      1
+
+/* Prototypes for functions defined in http_native.c  */
+
+int nhttp_supported (const char *url);
+char *nhttp_request (const char *method, const char *url, const char *customheader, const char *body, size_t len, long *status);
+void nhttp_cleanup (void);
+
+#endif
@@ -0,0 +1,292 @@
+/* multipart.c -- streaming multipart/form-data request bodies
+ *
+ * Copyright 2026 The liboauth contributors (see git log)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "xmalloc.h"
+#include "oauth.h"
+#include "fileio.h"
+#include "multipart.h"
+
+/* a part is serialized as: head, content, "\r\n" */
+struct mpart_part {
+	char *head;      //< delimiter line and part header
+	size_t head_len;
+	char *data;      //< content of a form field (NULL for files)
+	char *filename;  //< file to read the content from
+	off_t size;      //< length of the content
+};
+
+struct oauth_multipart {
+	char *boundary;
+	char *content_type;
+	char *tail;      //< close-delimiter
+	size_t tail_len;
+	struct mpart_part *parts;
+	int n_parts;
+};
+
+struct mpart_reader {
+	oauth_multipart *mp;
+	int part;        //< current part; n_parts: the tail
+	int phase;       //< 0: head, 1: content, 2: CRLF
+	off_t off;       //< offset in the current phase
+	fileio_reader *fr;
+};
+
+oauth_multipart *oauth_multipart_new(void) {
+	oauth_multipart *mp = (oauth_multipart*) xcalloc(1, sizeof(oauth_multipart));
+	char *nonce = oauth_gen_nonce();
+	size_t len = strlen(nonce);
+	mp->boundary = (char*) xmalloc(len + 16);
+	sprintf(mp->boundary, "liboauth-%s", nonce);
+	xfree(nonce);
+	mp->content_type = (char*) xmalloc(strlen(mp->boundary) + 32);
+	sprintf(mp->content_type, "multipart/form-data; boundary=%s", mp->boundary);
+	mp->tail = (char*) xmalloc(strlen(mp->boundary) + 8);
+	sprintf(mp->tail, "--%s--\r\n", mp->boundary);
+	mp->tail_len = strlen(mp->tail);
+	return mp;
+}
+
+void oauth_multipart_free(oauth_multipart *mp) {
+	int i;
+	if (!mp) return;
+	for (i = 0; i < mp->n_parts; i++) {
+		xfree(mp->parts[i].head);
+		xfree(mp->parts[i].data);
+		xfree(mp->parts[i].filename);
+	}
+	xfree(mp->parts);
+	xfree(mp->boundary);
+	xfree(mp->content_type);
+	xfree(mp->tail);
+	xfree(mp);
+}
+
+/**
+ * return a copy of s that can be used in a quoted-string of the
+ * Content-Disposition header: '"', CR and LF are percent-encoded.
+ */
+static char *mpart_quote(const char *s) {
+	char *rv = (char*) xmalloc(3 * strlen(s) + 1);
+	char *d = rv;
+	for (; *s; s++) {
+		switch (*s) {
+			case '"':  memcpy(d, "%22", 3); d += 3; break;
+			case '\r': memcpy(d, "%0D", 3); d += 3; break;
+			case '\n': memcpy(d, "%0A", 3); d += 3; break;
+			default: *d++ = *s; break;
+		}
+	}
+	*d = 0;
+	return rv;
+}
+
+static struct mpart_part *mpart_add(oauth_multipart *mp, const char *name, const char *filename, const char *content_type) {
+	struct mpart_part *p;
+	char *qn, *qf = NULL;
+	size_t len;
+	qn = mpart_quote(name);
+	len = strlen(mp->boundary) + strlen(qn) + 64;
+	if (filename) {
+		const char *base = strrchr(filename, '/');
+		qf = mpart_quote(base ? base + 1 : filename);
+		len += strlen(qf) + 16;
+	}
+	if (content_type) len += strlen(content_type) + 20;
+
+	mp->parts = (struct mpart_part*) xrealloc(mp->parts, (mp->n_parts + 1) * sizeof(struct mpart_part));
+	p = &mp->parts[mp->n_parts++];
+	memset(p, 0, sizeof(struct mpart_part));
+	p->head = (char*) xmalloc(len);
+	len = sprintf(p->head, "--%s\r\nContent-Disposition: form-data; name=\"%s\"", mp->boundary, qn);
+	if (qf) len += sprintf(p->head + len, "; filename=\"%s\"", qf);
+	len += sprintf(p->head + len, "\r\n");
+	if (content_type) len += sprintf(p->head + len, "Content-Type: %s\r\n", content_type);
+	len += sprintf(p->head + len, "\r\n");
+	p->head_len = len;
+	xfree(qn);
+	xfree(qf);
+	return p;
+}
+
+int oauth_multipart_add_field(oauth_multipart *mp, const char *name, const char *value, size_t len) {
+	struct mpart_part *p;
+	if (!mp || !name || (!value && len > 0)) return -1;
+	p = mpart_add(mp, name, NULL, NULL);
+	p->data = (char*) xmalloc(len + 1);
+	if (len > 0) memcpy(p->data, value, len);
+	p->size = len;
+	return 0;
+}
+
+int oauth_multipart_add_file(oauth_multipart *mp, const char *name, const char *filename, const char *content_type) {
+	struct mpart_part *p;
+	struct stat st;
+	if (!mp || !name || !filename) return -1;
+	if (stat(filename, &st) || !S_ISREG(st.st_mode)) return -1;
+	p = mpart_add(mp, name, filename, content_type ? content_type : "application/octet-stream");
+	p->filename = xstrdup(filename);
+	p->size = st.st_size;
+	return 0;
+}
+
+const char *oauth_multipart_content_type(oauth_multipart *mp) {
+	return mp ? mp->content_type : NULL;
+}
+
+long long oauth_multipart_length(oauth_multipart *mp) {
+	long long len;
+	int i;
+	if (!mp) return -1;
+	len = mp->tail_len;
+	for (i = 0; i < mp->n_parts; i++)
+		len += mp->parts[i].head_len + mp->parts[i].size + 2;
+	return len;
+}
+
+char *oauth_multipart_body_hash(oauth_multipart *mp) {
+	const size_t bufsiz = 256 * 1024;
+	oauth_body_hash_ctx *ctx;
+	mpart_reader *r;
+	char *buf;
+	ssize_t len;
+
+	if (!(r = mpart_open(mp))) return NULL;
+	if (!(ctx = oauth_body_hash_init())) {
+		mpart_close(r);
+		return NULL;
+	}
+	buf = (char*) xmalloc(bufsiz);
+	while ((len = mpart_read(r, buf, bufsiz)) > 0) {
+		if (oauth_body_hash_update(ctx, buf, len)) {
+			len = -1;
+			break;
+		}
+	}
+	xfree(buf);
+	mpart_close(r);
+	if (len < 0) {
+		oauth_body_hash_free(ctx);
+		return NULL;
+	}
+	return oauth_body_hash_final(ctx);
+}
+
+/**
+ * start reading the serialized body. Files are opened one at a time
+ * while they are read.
+ *
+ * @return reader or NULL on error
+ */
+mpart_reader *mpart_open (oauth_multipart *mp) {
+	mpart_reader *r;
+	if (!mp) return NULL;
+	r = (mpart_reader*) xcalloc(1, sizeof(mpart_reader));
+	r->mp = mp;
+	return r;
+}
+
+/* copy from a memory segment of the current phase */
+static size_t mpart_copy(mpart_reader *r, char *buf, size_t len, const char *src, size_t srclen) {
+	size_t n = srclen - (size_t) r->off;
+	if (n > len) n = len;
+	memcpy(buf, src + r->off, n);
+	r->off += n;
+	return n;
+}
+
+/**
+ * read the next bytes of the serialized body.
+ *
+ * @return number of bytes stored in buf (less than len only at the
+ * end of the body), 0 at the end, -1 on error (e.g. a file could not
+ * be read or changed its size).
+ */
+ssize_t mpart_read (mpart_reader *r, char *buf, size_t len) {
+	size_t done = 0;
+	while (done < len && r->part <= r->mp->n_parts) {
+		struct mpart_part *p;
+		size_t n;
+		if (r->part == r->mp->n_parts) {
+			n = mpart_copy(r, buf + done, len - done, r->mp->tail, r->mp->tail_len);
+			done += n;
+			if ((size_t) r->off == r->mp->tail_len) r->part++;
+			continue;
+		}
+		p = &r->mp->parts[r->part];
+		switch (r->phase) {
+			case 0:
+				done += mpart_copy(r, buf + done, len - done, p->head, p->head_len);
+				if ((size_t) r->off < p->head_len) continue;
+				break;
+			case 1:
+				if (p->data) {
+					done += mpart_copy(r, buf + done, len - done, p->data, (size_t) p->size);
+				} else {
+					ssize_t rd;
+					if (!r->fr && !(r->fr = fileio_open(p->filename, p->size)))
+						return -1;
+					n = len - done;
+					if ((off_t) n > p->size - r->off) n = (size_t) (p->size - r->off);
+					rd = n > 0 ? fileio_read(r->fr, buf + done, n) : 0;
+					if (rd < 0 || (rd == 0 && r->off < p->size)) return -1; // truncated
+					done += rd;
+					r->off += rd;
+				}
+				if (r->off < p->size) continue;
+				if (r->fr) {
+					fileio_close(r->fr);
+					r->fr = NULL;
+				}
+				break;
+			default:
+				done += mpart_copy(r, buf + done, len - done, "\r\n", 2);
+				if (r->off < 2) continue;
+				break;
+		}
+		r->off = 0;
+		if (++r->phase > 2) {
+			r->phase = 0;
+			r->part++;
+		}
+	}
+	return done;
+}
+
+void mpart_close (mpart_reader *r) {
+	if (!r) return;
+	if (r->fr) fileio_close(r->fr);
+	xfree(r);
+}
+// vi: sts=2 sw=2 ts=2
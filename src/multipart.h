@@ -0,0 +1,16 @@
+#ifndef _OAUTH_MULTIPART_H
+#define _OAUTH_MULTIPART_H      1
+
+#include <sys/types.h>
+#include "oauth.h"
+
+/* Prototypes for functions defined in multipart.c  */
+
+/** sequential reader of the serialized body, see \ref mpart_open */
+typedef struct mpart_reader mpart_reader;
+
+mpart_reader *mpart_open (oauth_multipart *mp);
+ssize_t mpart_read (mpart_reader *r, char *buf, size_t len);
+void mpart_close (mpart_reader *r);
+
+#endif
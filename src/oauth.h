@@ -60,6 +60,8 @@
 extern "C" {
 #endif
 
+struct iovec; // sys/uio.h
+
 /** \enum OAuthMethod
  * signature method to used for signing the request.
  */
@@ -492,6 +494,10 @@ char *oauth_sign_array (int *argcp, char***argvp,
  * a oauth_body_hash=xxxx parameter to be added to the request.
  * The returned string needs to be freed by the calling function.
  *
+ * Regular files are mmap()ed with sequential read-ahead if the
+ * platform supports it, otherwise the file is read in large chunks.
+ * Files larger than 4GB are supported on hosts with large-file support.
+ *
  * see
  * http://oauth.googlecode.com/svn/spec/ext/body_hash/1.0/oauth-bodyhash.html
  *
@@ -518,6 +524,38 @@ char *oauth_body_hash_file(char *filename);
  */
 char *oauth_body_hash_data(size_t length, const char *data);
 
+/**
+ * calculate body hash (sha1sum) of data that is scattered over
+ * several buffers and return a oauth_body_hash=xxxx parameter.
+ * The result is identical to calling \ref oauth_body_hash_data
+ * with all buffers concatenated, but no copy is made.
+ * The returned string needs to be freed by the calling function.
+ *
+ * @param iov array of buffers to hash (in order)
+ * @param iovcnt number of elements in the array
+ *
+ * @return URL oauth_body_hash parameter string
+ */
+char *oauth_body_hash_iov(const struct iovec *iov, int iovcnt);
+
+/**
+ * calculate body hashes of many files concurrently.
+ * The files are distributed over a pool of worker threads, each
+ * hashing one file at a time with \ref oauth_body_hash_file.
+ * If liboauth was built without thread support the files are
+ * hashed sequentially.
+ *
+ * @param n number of files
+ * @param filenames array of n filenames
+ * @param results array of n (char*) where the oauth_body_hash=xxxx
+ *  parameter for each file is stored (or NULL if the file could not
+ *  be read). The strings need to be freed by the caller.
+ * @param nthreads number of worker threads; 0 to use one per online CPU.
+ *
+ * @return number of files that could not be hashed
+ */
+int oauth_body_hash_files(int n, const char **filenames, char **results, int nthreads);
+
 /**
  * base64 encode digest, free it and return a URL parameter
  * with the oauth_body_hash. The returned hash needs to be freed by the
@@ -531,6 +569,87 @@ char *oauth_body_hash_data(size_t length, const char *data);
  */
 char *oauth_body_hash_encode(size_t len, unsigned char *digest);
 
+/**
+ * opaque state of an incremental body hash calculation.
+ * see \ref oauth_body_hash_init
+ */
+typedef struct oauth_body_hash_ctx oauth_body_hash_ctx;
+
+/**
+ * start an incremental body hash (sha1sum) calculation.
+ * This allows one to hash data that is generated on the fly
+ * without keeping the complete body in memory.
+ *
+ * Feed the data with \ref oauth_body_hash_update and retrieve the
+ * oauth_body_hash=xxxx parameter with \ref oauth_body_hash_final.
+ *
+ * @return hash context or NULL on error
+ */
+oauth_body_hash_ctx *oauth_body_hash_init(void);
+
+/**
+ * add data to an incremental body hash calculation.
+ *
+ * @param ctx hash context as returned by \ref oauth_body_hash_init
+ * @param data data to add
+ * @param length length of the data in bytes
+ * @return 0 on success, -1 on error
+ */
+int oauth_body_hash_update(oauth_body_hash_ctx *ctx, const void *data, size_t length);
+
+/**
+ * finish an incremental body hash calculation and return a
+ * oauth_body_hash=xxxx parameter (same as \ref oauth_body_hash_encode).
+ * The context is freed and must not be used afterwards.
+ * The returned string needs to be freed by the calling function.
+ *
+ * @param ctx hash context as returned by \ref oauth_body_hash_init
+ * @return URL oauth_body_hash parameter string or NULL on error
+ */
+char *oauth_body_hash_final(oauth_body_hash_ctx *ctx);
+
+/**
+ * discard an incremental body hash calculation without
+ * retrieving the result.
+ *
+ * @param ctx hash context as returned by \ref oauth_body_hash_init (may be NULL)
+ */
+void oauth_body_hash_free(oauth_body_hash_ctx *ctx);
+
+/**
+ * gzip-compress a request body and calculate the body hash of the
+ * compressed bytes in the same pass.
+ * (requires zlib)
+ *
+ * The data is compressed in chunks; each chunk of output is hashed
+ * as soon as it is produced, so the payload is read only once and the
+ * only copy made is the (compressed) result. Sign the request with
+ * the returned oauth_body_hash parameter and send the compressed body
+ * with a "Content-Encoding: gzip" header, e.g. using
+ * \ref oauth_curl_send_data_with_callback.
+ *
+ * @param data the body to compress
+ * @param len length of data in bytes
+ * @param gzlen the length of the compressed body is stored here
+ * @param body_hash if not NULL, the oauth_body_hash=xxxx parameter of
+ * the compressed body is stored here; it needs to be freed by the caller.
+ * @return the compressed body that needs to be freed by the caller,
+ * or NULL on error or if liboauth was compiled without zlib.
+ */
+char *oauth_body_gzip(const char *data, size_t len, size_t *gzlen, char **body_hash);
+
+/**
+ * same as \ref oauth_body_gzip for the content of a file.
+ *
+ * @param filename file to read
+ * @param gzlen the length of the compressed body is stored here
+ * @param body_hash if not NULL, the oauth_body_hash=xxxx parameter of
+ * the compressed body is stored here; it needs to be freed by the caller.
+ * @return the compressed file content that needs to be freed by the
+ * caller, or NULL on error or if liboauth was compiled without zlib.
+ */
+char *oauth_body_gzip_file(const char *filename, size_t *gzlen, char **body_hash);
+
 /**
  * xep-0235 - TODO
  */
@@ -774,6 +893,835 @@ char *oauth_send_data_with_callback      (const char *u,
                                           void *callback_data,
                                           const char *httpMethod) attribute_deprecated;
 
+/**
+ * http send raw data that is scattered over several buffers, with callback.
+ * This is equivalent to \ref oauth_send_data_with_callback with all
+ * buffers concatenated, except that the request body is read directly
+ * from the given buffers. The buffers must remain valid until the
+ * function returns.
+ *
+ * the returned string needs to be freed by the caller
+ * (requires libcurl)
+ *
+ * @param u url to retrieve
+ * @param iov array of buffers that make up the request body (in order)
+ * @param iovcnt number of elements in the array
+ * @param customheader specify custom HTTP header (or NULL for default)
+ * Multiple header elements can be passed separating them with "\r\n"
+ * @param callback specify the callback function (or NULL)
+ * @param callback_data specify data to pass to the callback function
+ * @param httpMethod specify http verb ("GET"/"POST"/"PUT"/"DELETE") to be used. if httpMethod is NULL, a POST is executed.
+ * @return returned HTTP reply or NULL on error
+ */
+char *oauth_send_iov_with_callback       (const char *u,
+                                          const struct iovec *iov,
+                                          int iovcnt,
+                                          const char *customheader,
+                                          void (*callback)(void*,int,size_t,size_t),
+                                          void *callback_data,
+                                          const char *httpMethod);
+
+/**
+ * http send the content of a file, with callback.
+ * the returned string needs to be freed by the caller
+ * (requires libcurl)
+ *
+ * The file is memory-mapped (or read with large buffers if that is not
+ * possible) and copied straight into libcurl's upload buffer. Files
+ * larger than 4GB are supported if liboauth was built with large-file
+ * support. The callback is invoked with the same arguments as for
+ * \ref oauth_send_data_with_callback; on 32bit hosts the progress
+ * values wrap for files over 4GB.
+ *
+ * @param u url to retrieve
+ * @param fn filename of a regular file to send along
+ * @param customheader specify custom HTTP header (or NULL for default)
+ * Multiple header elements can be passed separating them with "\r\n"
+ * @param callback specify the callback function (or NULL)
+ * @param callback_data specify data to pass to the callback function
+ * @param httpMethod specify http verb ("POST"/"PUT"/..) to be used. if httpMethod is NULL, a POST is executed.
+ * @return returned HTTP reply or NULL on error
+ */
+char *oauth_send_file_with_callback      (const char *u,
+                                          const char *fn,
+                                          const char *customheader,
+                                          void (*callback)(void*,int,size_t,size_t),
+                                          void *callback_data,
+                                          const char *httpMethod);
+
+/**
+ * opaque multipart/form-data request body, see \ref oauth_multipart_new
+ */
+typedef struct oauth_multipart oauth_multipart;
+
+/**
+ * create an empty multipart/form-data body.
+ *
+ * Add form fields and files to it, then send it with
+ * \ref oauth_send_multipart. Files are only referenced: they are read
+ * from disk while the body is sent (and while its body hash is
+ * calculated), so the body is never assembled in memory.
+ *
+ * @return the body that needs to be freed with \ref oauth_multipart_free
+ */
+oauth_multipart *oauth_multipart_new(void);
+
+/**
+ * free a multipart body.
+ *
+ * @param mp body to free (may be NULL)
+ */
+void oauth_multipart_free(oauth_multipart *mp);
+
+/**
+ * append a form field; the value is copied.
+ *
+ * @param mp the multipart body
+ * @param name name of the field
+ * @param value content of the field
+ * @param len length of value in bytes
+ * @return 0 on success, -1 on error
+ */
+int oauth_multipart_add_field(oauth_multipart *mp, const char *name, const char *value, size_t len);
+
+/**
+ * append the content of a file. The file is not read until the body
+ * is sent; it must not be modified in the meantime.
+ *
+ * @param mp the multipart body
+ * @param name name of the field
+ * @param filename path of a regular file; its last component is used
+ * as filename parameter of the part
+ * @param content_type type of the part or NULL for "application/octet-stream"
+ * @return 0 on success, -1 if the file is not a regular file
+ */
+int oauth_multipart_add_file(oauth_multipart *mp, const char *name, const char *filename, const char *content_type);
+
+/**
+ * @param mp the multipart body
+ * @return the value of the Content-Type header for the body (including
+ * the boundary); owned by mp.
+ */
+const char *oauth_multipart_content_type(oauth_multipart *mp);
+
+/**
+ * @param mp the multipart body
+ * @return length of the serialized body in bytes or -1 on error
+ */
+long long oauth_multipart_length(oauth_multipart *mp);
+
+/**
+ * calculate the body hash of the serialized multipart body and
+ * return a oauth_body_hash=xxxx parameter (see \ref oauth_body_hash_data).
+ * The body is streamed through the hash, files are read from disk.
+ * The returned string needs to be freed by the calling function.
+ *
+ * @param mp the multipart body
+ * @return URL oauth_body_hash parameter string or NULL on error
+ */
+char *oauth_multipart_body_hash(oauth_multipart *mp);
+
+/**
+ * http send a multipart/form-data body, with callback.
+ * the returned string needs to be freed by the caller
+ * (requires libcurl)
+ *
+ * The body is serialized while it is sent, files are read from disk
+ * in large chunks. The Content-Type header (with the boundary) is
+ * added automatically. The callback is invoked with the same arguments
+ * as for \ref oauth_send_data_with_callback.
+ *
+ * @param u url to retrieve
+ * @param mp the multipart body
+ * @param customheader specify additional custom HTTP header (or NULL)
+ * Multiple header elements can be passed separating them with "\r\n"
+ * @param callback specify the callback function (or NULL)
+ * @param callback_data specify data to pass to the callback function
+ * @param httpMethod specify http verb ("POST"/"PUT"/..) to be used. if httpMethod is NULL, a POST is executed.
+ * @return returned HTTP reply or NULL on error
+ */
+char *oauth_send_multipart               (const char *u,
+                                          oauth_multipart *mp,
+                                          const char *customheader,
+                                          void (*callback)(void*,int,size_t,size_t),
+                                          void *callback_data,
+                                          const char *httpMethod);
+
+/**
+ * opaque HTTP client; it owns a pool of reusable libcurl handles.
+ * see \ref oauth_http_client_new
+ */
+typedef struct oauth_http_client oauth_http_client;
+
+/**
+ * create a HTTP client with a pool of reusable connections.
+ * (requires libcurl)
+ *
+ * Handles are kept open between requests so that keep-alive
+ * connections (and TLS sessions) are reused when talking to the same
+ * host again. A client may be used from several threads concurrently.
+ * The DNS cache and TLS session IDs are shared process-wide between
+ * all clients and threads.
+ *
+ * The oauth_http_* and oauth_post_* functions use a default client,
+ * see \ref oauth_http_client_default.
+ *
+ * @param max_idle maximum number of idle handles kept in the pool
+ * (0: use the default of 8)
+ * @return client that needs to be freed with \ref oauth_http_client_free,
+ * or NULL if liboauth was compiled without libcurl.
+ */
+oauth_http_client *oauth_http_client_new(int max_idle);
+
+/**
+ * close all connections of the client and free it.
+ *
+ * @param c client to free (may be NULL)
+ */
+void oauth_http_client_free(oauth_http_client *c);
+
+/** \enum OAuthHttpOption
+ * client options, see \ref oauth_http_client_setopt.
+ *
+ * With \ref OA_HTTP_RATE_LIMIT, each request takes a token from the
+ * bucket of its host and - if it is signed - from the bucket of its
+ * consumer key at that host. The buckets refill at the configured
+ * rates, and follow the quota reported in the replies (Retry-After,
+ * X-RateLimit-Remaining/-Reset or RateLimit-Remaining/-Reset; the
+ * latter two require libcurl >= 7.84.0): the remaining quota is spread
+ * over the rest of the window, and no requests are sent while it is
+ * exhausted. The blocking request functions (including
+ * \ref oauth_http_client_get_hedged, \ref oauth_http_upload_chunks and
+ * \ref oauth_http_download_ranges, for every request they send) wait
+ * for a token; \ref oauth_http_multi and \ref oauth_http_loop_add keep
+ * requests queued while other hosts or consumers can go ahead.
+ * Buckets that were not used for a minute are dropped.
+ *
+ * With \ref OA_HTTP_COALESCE, a call of \ref oauth_http_client_get
+ * (and \ref oauth_http_get2 for the default client) that asks the
+ * same as a GET still in progress on another thread - same URL and
+ * parameters apart from nonce, timestamp and signature, same consumer
+ * key, token and custom headers - does not send its own request but
+ * waits for that one and returns a copy of its reply.
+ */
+typedef enum {
+    OA_HTTP_MAX_HOST_CONNECTIONS=0, ///< max. parallel connections to a single host used by \ref oauth_http_multi (default: 6, 0: unlimited)
+    OA_HTTP_MAX_PARALLEL, ///< max. number of transfers \ref oauth_http_multi runs at once (default: 64)
+    OA_HTTP_POOLED_BUFFERS, ///< number of response buffers kept for reuse, see \ref oauth_http_client_recycle (default: 4, max: 16)
+    OA_HTTP_VERSION, ///< HTTP protocol version to use, one of \ref OAuthHttpVersion
+    OA_HTTP_MAX_STREAMS, ///< max. number of concurrent HTTP/2 streams on one connection (default: 100)
+    OA_HTTP_ACCEPT_ENCODING, ///< 1: request compressed responses (gzip, deflate and - if libcurl supports them - br, zstd); replies are decompressed transparently while they are received (default: 0)
+    OA_HTTP_HEDGE_PERCENTILE, ///< \ref oauth_http_client_get_hedged sends a second copy of a request that takes longer than this percentile of the recent latencies (1..100, default: 95, 0: never)
+    OA_HTTP_HEDGE_DELAY, ///< delay in ms before a hedged copy is sent as long as too few latencies were measured, and lower bound of that delay (default: 100)
+    OA_HTTP_RATE_LIMIT, ///< 1: pace requests by per-host and per-consumer-key token buckets, see \ref OAuthHttpOption (default: 0)
+    OA_HTTP_RATE_HOST, ///< requests per second to a single host with \ref OA_HTTP_RATE_LIMIT (default: 0, unlimited unless the provider reports a quota)
+    OA_HTTP_RATE_CONSUMER, ///< requests per second per consumer key (and host) with \ref OA_HTTP_RATE_LIMIT (default: 0, unlimited unless the provider reports a quota)
+    OA_HTTP_CACHE, ///< bytes of GET replies kept in memory for conditional requests, see \ref oauth_http_client_cache_dir (default: 0, no cache; requires libcurl >= 7.84.0)
+    OA_HTTP_COALESCE, ///< 1: identical concurrent GETs share one upstream request, see \ref OAuthHttpOption (default: 0; requires pthreads)
+    OA_HTTP_CACHE_DISK ///< bytes of replies kept in the directory of \ref oauth_http_client_cache_dir (default: 64 MB, 0: none are written)
+  } OAuthHttpOption;
+
+/** \enum OAuthHttpVersion
+ * values for the \ref OA_HTTP_VERSION client option.
+ *
+ * With HTTP/2 the concurrent requests of \ref oauth_http_multi and
+ * \ref oauth_http_loop_add to the same host are multiplexed over a
+ * single connection (up to \ref OA_HTTP_MAX_STREAMS at once) instead
+ * of opening one connection per request.
+ */
+typedef enum {
+    OA_HTTP_VERSION_DEFAULT=0, ///< let libcurl decide (recent versions negotiate HTTP/2 for https)
+    OA_HTTP_VERSION_1_1, ///< always use HTTP/1.1
+    OA_HTTP_VERSION_2, ///< negotiate HTTP/2 via ALPN for https, HTTP/1.1 for plain http (requires libcurl >= 7.49.0 with HTTP/2 support)
+    OA_HTTP_VERSION_2_PRIOR_KNOWLEDGE ///< use HTTP/2 without negotiation, also for plain http (h2c), e.g. for local test servers
+  } OAuthHttpVersion;
+
+/**
+ * change a setting of the client.
+ *
+ * @param c client to modify
+ * @param opt option to set
+ * @param value new value
+ * @return 0 on success, -1 if the option or value is invalid.
+ */
+int oauth_http_client_setopt(oauth_http_client *c, OAuthHttpOption opt, long value);
+
+/**
+ * keep the replies of cached requests (see \ref OA_HTTP_CACHE) also
+ * in a directory, so they survive the client and are shared by the
+ * clients that use the same directory. Entries that were evicted from
+ * memory are loaded from there. The directory is kept within
+ * \ref OA_HTTP_CACHE_DISK bytes by removing the replies that were
+ * least recently stored or loaded (by modification time).
+ *
+ * With the cache enabled, GET requests made with
+ * \ref oauth_http_client_get, \ref oauth_http_multi (and the
+ * functions that use those) are identified by their normalized form:
+ * the URL with sorted parameters, without the nonce, timestamp and
+ * signature, but including the consumer key and token (also if they
+ * are sent in an Authorization header) and the other custom headers.
+ * Replies with an ETag or Last-Modified header (and without
+ * "Cache-Control: no-store") are remembered. The next - freshly signed
+ * - request for the same resource is sent with If-None-Match and/or
+ * If-Modified-Since, and a "304 Not Modified" reply is answered with
+ * the cached content (and reported as status 200).
+ *
+ * @param c client
+ * @param dir existing directory, or NULL to only cache in memory
+ * @return 0 on success, -1 if the directory does not exist (or
+ * liboauth was compiled without libcurl)
+ */
+int oauth_http_client_cache_dir(oauth_http_client *c, const char *dir);
+
+/**
+ * hand a reply that was returned by one of the oauth_http_client_*
+ * functions back to the client instead of freeing it.
+ *
+ * Response buffers grow geometrically (or are allocated at once if the
+ * server announces a Content-Length of up to 1 MB); recycled buffers are
+ * reused for subsequent responses, which avoids repeated allocations
+ * when fetching many documents. Any buffer that was allocated with
+ * malloc() may be passed. If the pool is full, or the buffer is larger
+ * than 4 MB, the buffer is freed.
+ *
+ * @param c client to return the buffer to (NULL: just free it)
+ * @param reply the reply (may be NULL)
+ */
+void oauth_http_client_recycle(oauth_http_client *c, char *reply);
+
+/**
+ * return the process-wide default client that is used by the
+ * oauth_http_* functions. It is created on first use and must
+ * not be freed by the caller; see \ref oauth_http_global_cleanup.
+ *
+ * @return default client or NULL if liboauth was compiled without libcurl.
+ */
+oauth_http_client *oauth_http_client_default(void);
+
+/**
+ * release all global resources of the HTTP layer (the default client
+ * and its connections). Call this once before the application exits;
+ * the default client is re-created if it is used again afterwards.
+ *
+ * All clients created with \ref oauth_http_client_new must be freed
+ * with \ref oauth_http_client_free before. Otherwise only the default
+ * client is released: libcurl's global state and the shared DNS and
+ * TLS session cache are kept, since those clients still use them.
+ */
+void oauth_http_global_cleanup(void);
+
+/**
+ * use a file as persistent TLS session cache.
+ * (requires libcurl >= 8.12.0 with SSL session export support)
+ *
+ * The TLS sessions stored in the file are loaded into the process-wide
+ * session cache right away, so that the first HTTPS request of a new
+ * process can resume a session instead of doing a full handshake.
+ * The cache is written back by \ref oauth_http_session_cache_flush,
+ * \ref oauth_http_global_cleanup and - if neither was called - when
+ * the process exits (via atexit()), so short-lived programs keep it
+ * up to date without any further call.
+ *
+ * Alternatively the file can be specified with the environment
+ * variable OAUTH_HTTP_SESSION_CACHE.
+ *
+ * The file contains session secrets, it is created with mode 0600.
+ *
+ * @param filename path of the cache file or NULL to disable the cache
+ * @return number of sessions that were loaded, -1 if this is not supported.
+ */
+int oauth_http_session_cache(const char *filename);
+
+/**
+ * write the process-wide TLS session cache to the file given
+ * with \ref oauth_http_session_cache.
+ *
+ * @return 0 on success, -1 on error or if no cache file is set.
+ */
+int oauth_http_session_cache_flush(void);
+
+/**
+ * same as \ref oauth_http_get2 using the given client.
+ *
+ * @param c client to use
+ * @param u base url to get
+ * @param q query string to send along with the HTTP request or NULL.
+ * @param customheader specify custom HTTP header (or NULL for none)
+ * @return  In case of an error NULL is returned; otherwise a pointer to the
+ * replied content from HTTP server. latter needs to be freed by caller.
+ */
+char *oauth_http_client_get (oauth_http_client *c, const char *u, const char *q, const char *customheader);
+
+/**
+ * same as \ref oauth_http_post2 using the given client.
+ *
+ * @param c client to use
+ * @param u url to query
+ * @param p postargs to send along with the HTTP request.
+ * @param customheader specify custom HTTP header (or NULL for none)
+ * @return replied content from HTTP server. needs to be freed by caller.
+ */
+char *oauth_http_client_post (oauth_http_client *c, const char *u, const char *p, const char *customheader);
+
+/**
+ * same as \ref oauth_post_file using the given client.
+ *
+ * @param c client to use
+ * @param u url to retrieve
+ * @param fn filename of the file to post along
+ * @param len length of the file in bytes. set to '0' for autodetection
+ * @param customheader specify custom HTTP header (or NULL for default).
+ * @return returned HTTP reply or NULL on error
+ */
+char *oauth_http_client_post_file (oauth_http_client *c, const char *u, const char *fn, size_t len, const char *customheader);
+
+/**
+ * same as \ref oauth_send_file_with_callback using the given client.
+ *
+ * @param c client to use
+ * @param u url to retrieve
+ * @param fn filename of a regular file to send along
+ * @param customheader specify custom HTTP header (or NULL for default)
+ * @param callback specify the callback function (or NULL)
+ * @param callback_data specify data to pass to the callback function
+ * @param httpMethod specify http verb to be used. if httpMethod is NULL, a POST is executed.
+ * @return returned HTTP reply or NULL on error
+ */
+char *oauth_http_client_send_file (oauth_http_client *c,
+                                   const char *u,
+                                   const char *fn,
+                                   const char *customheader,
+                                   void (*callback)(void*,int,size_t,size_t),
+                                   void *callback_data,
+                                   const char *httpMethod);
+
+/**
+ * same as \ref oauth_send_multipart using the given client.
+ *
+ * @param c client to use
+ * @param u url to retrieve
+ * @param mp the multipart body
+ * @param customheader specify additional custom HTTP header (or NULL)
+ * @param callback specify the callback function (or NULL)
+ * @param callback_data specify data to pass to the callback function
+ * @param httpMethod specify http verb to be used. if httpMethod is NULL, a POST is executed.
+ * @return returned HTTP reply or NULL on error
+ */
+char *oauth_http_client_send_multipart (oauth_http_client *c,
+                                        const char *u,
+                                        oauth_multipart *mp,
+                                        const char *customheader,
+                                        void (*callback)(void*,int,size_t,size_t),
+                                        void *callback_data,
+                                        const char *httpMethod);
+
+/**
+ * same as \ref oauth_send_iov_with_callback using the given client.
+ *
+ * @param c client to use
+ * @param u url to retrieve
+ * @param iov array of buffers that make up the request body (in order)
+ * @param iovcnt number of elements in the array
+ * @param customheader specify custom HTTP header (or NULL for default)
+ * @param callback specify the callback function (or NULL)
+ * @param callback_data specify data to pass to the callback function
+ * @param httpMethod specify http verb to be used. if httpMethod is NULL, a POST is executed.
+ * @return returned HTTP reply or NULL on error
+ */
+char *oauth_http_client_send_iov (oauth_http_client *c,
+                                  const char *u,
+                                  const struct iovec *iov,
+                                  int iovcnt,
+                                  const char *customheader,
+                                  void (*callback)(void*,int,size_t,size_t),
+                                  void *callback_data,
+                                  const char *httpMethod);
+
+/**
+ * receives the response body chunk by chunk.
+ *
+ * @param data the next part of the response body (not nul terminated)
+ * @param len number of bytes in data
+ * @param arg user data as given in \ref oauth_http_sink
+ * @return 0 to continue, any other value aborts the transfer
+ */
+typedef int (*oauth_http_sink_cb)(const char *data, size_t len, void *arg);
+
+/**
+ * receives the response header lines one by one, including the
+ * status line(s), without the trailing CRLF.
+ *
+ * @param line header line (not nul terminated)
+ * @param len length of the line in bytes
+ * @param arg user data as given in \ref oauth_http_sink
+ * @return 0 to continue, any other value aborts the transfer
+ */
+typedef int (*oauth_http_header_cb)(const char *line, size_t len, void *arg);
+
+/**
+ * destination of a streamed response, see \ref oauth_http_stream.
+ */
+typedef struct {
+  oauth_http_sink_cb write;     ///< body callback, or NULL to write the body to fd
+  int fd;                       ///< file descriptor the body is written to if write is NULL
+  oauth_http_header_cb header;  ///< header callback or NULL
+  void *arg;                    ///< user data passed to the callbacks
+  long status;                  ///< HTTP status code; set before the first body chunk is delivered
+} oauth_http_sink;
+
+/**
+ * perform a HTTP request and stream the reply to a sink instead of
+ * accumulating it in memory. The body is handed over as it arrives,
+ * so arbitrarily large downloads can be processed (or written to
+ * disk) with constant memory.
+ * (requires libcurl)
+ *
+ * @param u url to query (including the signed query string, if any)
+ * @param httpMethod HTTP verb; NULL: "POST" if body is set, "GET" otherwise
+ * @param body request body or NULL
+ * @param len length of body in bytes
+ * @param customheader specify custom HTTP header (or NULL for none)
+ * Multiple header elements can be passed separating them with "\r\n"
+ * @param sink where to deliver the response
+ * @return 0 on success, otherwise a libcurl error code (CURLcode);
+ * -1 if liboauth was compiled without libcurl.
+ */
+int oauth_http_stream (const char *u, const char *httpMethod, const char *body, size_t len, const char *customheader, oauth_http_sink *sink);
+
+/**
+ * same as \ref oauth_http_stream using the given client.
+ *
+ * @param c client to use
+ * @param u url to query
+ * @param httpMethod HTTP verb; NULL: "POST" if body is set, "GET" otherwise
+ * @param body request body or NULL
+ * @param len length of body in bytes
+ * @param customheader specify custom HTTP header (or NULL for none)
+ * @param sink where to deliver the response
+ * @return 0 on success, otherwise a libcurl error code (CURLcode)
+ */
+int oauth_http_client_stream (oauth_http_client *c, const char *u, const char *httpMethod, const char *body, size_t len, const char *customheader, oauth_http_sink *sink);
+
+/**
+ * a single request of a batch, see \ref oauth_http_multi.
+ * The first group of fields is set by the caller, the second
+ * group is filled in when the request completes.
+ */
+typedef struct {
+  const char *url;          ///< URL including the (signed) query string
+  const char *method;       ///< HTTP verb; NULL: "POST" if body is set, "GET" otherwise
+  const char *body;         ///< request body or NULL; must stay valid until the request completes
+  size_t body_len;          ///< length of body in bytes
+  const char *customheader; ///< custom HTTP header(s) separated by "\r\n", or NULL
+  void *userdata;           ///< not used by liboauth
+
+  char *reply;              ///< reply content or NULL on error; needs to be freed (or recycled) by the caller
+  size_t reply_len;         ///< length of reply in bytes
+  long status;              ///< HTTP status code (0 if no response was received)
+  int error;                ///< 0 on success, otherwise a libcurl error code (CURLcode) or curl's exit code, which uses the same numbering
+} oauth_http_request;
+
+/**
+ * called by \ref oauth_http_multi whenever a request of the batch
+ * completes (in the calling thread).
+ *
+ * @param req the completed request
+ * @param arg user data as passed to \ref oauth_http_multi
+ */
+typedef void (*oauth_http_done_cb)(oauth_http_request *req, void *arg);
+
+/**
+ * perform a batch of HTTP requests concurrently.
+ * (requires libcurl, the built-in HTTP client or a command-line curl)
+ *
+ * All requests are multiplexed on the calling thread using
+ * libcurl's multi interface; they complete in arbitrary order.
+ * At most \ref OA_HTTP_MAX_PARALLEL transfers are active at once and
+ * at most \ref OA_HTTP_MAX_HOST_CONNECTIONS connections are opened
+ * to each host, further requests are queued. Connections are kept
+ * open in the client for subsequent batches.
+ *
+ * Without libcurl the requests are performed sequentially and c may
+ * be NULL. Requests the built-in client can not handle are passed
+ * to a single curl process ('curl -K -'), which re-uses its
+ * connections within the batch; their bodies must not contain NUL
+ * bytes.
+ *
+ * Sign each request beforehand, e.g. with \ref oauth_sign_url2.
+ * The results are stored in the request array; in addition the
+ * optional callback is invoked as soon as each request completes.
+ *
+ * @param c client to use
+ * @param reqs array of requests
+ * @param n number of elements in reqs
+ * @param done completion callback or NULL
+ * @param arg user data passed to the callback
+ * @return number of requests that failed (error != 0), or -1 if
+ * liboauth was compiled without any HTTP transport.
+ */
+int oauth_http_multi(oauth_http_client *c, oauth_http_request *reqs, int n, oauth_http_done_cb done, void *arg);
+
+/**
+ * called by \ref oauth_http_upload_chunks to build the request for a
+ * chunk. It is called again for each retry of the chunk, and when
+ * the rate limit (\ref OA_HTTP_RATE_LIMIT) held the chunk back.
+ *
+ * @param index number of the chunk, starting at 0
+ * @param offset position of the chunk in the file
+ * @param len length of the chunk in bytes
+ * @param total size of the file in bytes
+ * @param customheader may be set to additional header(s) for this
+ * chunk (e.g. a Content-Range); it must be allocated with malloc() and
+ * is freed by liboauth. Unless it contains a Content-Type, the
+ * chunk is sent as "application/octet-stream".
+ * @param arg user data as given in \ref oauth_chunked_upload
+ * @return URL of the chunk request without OAuth parameters (allocated
+ * with malloc(), freed by liboauth), or NULL to fail the chunk.
+ */
+typedef char *(*oauth_chunk_url_cb)(int index, long long offset, size_t len, long long total, char **customheader, void *arg);
+
+/**
+ * called by \ref oauth_http_upload_chunks when a chunk was uploaded,
+ * or failed for good.
+ *
+ * @param index number of the chunk
+ * @param status HTTP status code of the last attempt (0 if no response was received)
+ * @param reply reply of the server (NULL on transfer errors), only valid during the call
+ * @param reply_len length of reply in bytes
+ * @param arg user data as given in \ref oauth_chunked_upload
+ */
+typedef void (*oauth_chunk_done_cb)(int index, long status, const char *reply, size_t reply_len, void *arg);
+
+/**
+ * description of a chunked upload, see \ref oauth_http_upload_chunks.
+ * Unused fields should be zero.
+ */
+typedef struct {
+  const char *filename;     ///< regular file to upload
+  size_t chunk_size;        ///< bytes per chunk (0: 8MB)
+  int parallel;             ///< number of chunks uploaded concurrently (0: 4)
+  int retries;              ///< retries per chunk after network errors, 5xx, 408 and 429 replies (0: 3, -1: none)
+  const char *manifest;     ///< file that records completed chunks so an interrupted upload can be resumed, or NULL
+  const char *method;       ///< HTTP verb for the chunk requests (NULL: "POST")
+  int body_hash;            ///< if set, an oauth_body_hash parameter of the chunk is added before signing
+  int auth_header;          ///< if set, the OAuth parameters are sent in an Authorization header instead of the query string
+  OAuthMethod sig_method;   ///< signature method
+  const char *c_key;        ///< consumer key
+  const char *c_secret;     ///< consumer secret
+  const char *t_key;        ///< token key (or NULL)
+  const char *t_secret;     ///< token secret (or NULL)
+  oauth_chunk_url_cb url;   ///< builds the URL of each chunk request (required)
+  oauth_chunk_done_cb done; ///< completion callback or NULL
+  void *arg;                ///< user data passed to the callbacks
+} oauth_chunked_upload;
+
+/**
+ * upload a large file in chunks, several chunks at a time.
+ * (requires libcurl)
+ *
+ * The file is split into ranges of chunk_size bytes. Each chunk is sent
+ * as a separate request that is signed individually, with a fresh
+ * nonce and timestamp for every attempt. The chunks are read straight
+ * from the file (memory-mapped where possible) and uploaded
+ * concurrently over the client's connections, in the calling thread.
+ * Failed chunks are retried with exponential back-off.
+ *
+ * If a manifest file is given, the index of each completed chunk is
+ * appended to it. Calling this function again with the same manifest
+ * skips those chunks, unless the file, its modification time or the
+ * chunk size changed. The manifest is removed once all chunks were
+ * uploaded.
+ *
+ * Committing the upload (if the provider requires that) is up to the
+ * caller.
+ *
+ * @param c client to use
+ * @param upload description of the upload
+ * @return 0 if all chunks were uploaded, the number of chunks that
+ * failed, or -1 on error (the file or manifest could not be opened,
+ * the file needs more chunks than fit in an int - use a larger
+ * chunk_size - or liboauth was compiled without libcurl).
+ */
+int oauth_http_upload_chunks(oauth_http_client *c, const oauth_chunked_upload *upload);
+
+/**
+ * description of a parallel ranged download, see
+ * \ref oauth_http_download_ranges. Unused fields should be zero.
+ */
+typedef struct {
+  const char *url;          ///< URL of the resource without OAuth parameters
+  const char *filename;     ///< output file; it is created or truncated
+  size_t chunk_size;        ///< bytes per range request (0: 8MB)
+  int parallel;             ///< number of ranges downloaded concurrently (0: 4)
+  int retries;              ///< retries per range after network errors, 5xx, 408 and 429 replies (0: 3, -1: none)
+  const char *customheader; ///< additional header(s) sent with every request, or NULL
+  int auth_header;          ///< if set, the OAuth parameters are sent in an Authorization header instead of the query string
+  OAuthMethod sig_method;   ///< signature method
+  const char *c_key;        ///< consumer key
+  const char *c_secret;     ///< consumer secret
+  const char *t_key;        ///< token key (or NULL)
+  const char *t_secret;     ///< token secret (or NULL)
+} oauth_ranged_download;
+
+/**
+ * download a large resource to a file with several concurrent
+ * "Range" GET requests.
+ * (requires libcurl)
+ *
+ * The first range request doubles as probe: its Content-Range reply
+ * header tells the size of the resource. The output file is then
+ * preallocated and the remaining ranges are requested, each signed
+ * individually with a fresh nonce and timestamp. Every range is
+ * written straight to its position in the file with pwrite(), in the
+ * calling thread. If the first reply carried a strong ETag, the other
+ * requests are made conditional on it (If-Range), so a resource that
+ * changes during the download fails it rather than mixing versions.
+ *
+ * Failed ranges are retried with exponential back-off, continuing
+ * where the previous attempt broke off. A server that ignores the
+ * Range header is handled too: its complete reply to the first
+ * request is written out as a whole.
+ *
+ * @param c client to use
+ * @param download description of the download
+ * @return size of the resource in bytes, or -1 if it could not be
+ * downloaded completely (the content of the output file is undefined
+ * then), needs more ranges than fit in an int (use a larger
+ * chunk_size), or liboauth was compiled without libcurl.
+ */
+long long oauth_http_download_ranges(oauth_http_client *c, const oauth_ranged_download *download);
+
+/**
+ * hedged HTTP GET request for idempotent resources.
+ * (requires libcurl)
+ *
+ * The request is signed and sent; if no reply arrived after the
+ * \ref OA_HTTP_HEDGE_PERCENTILE of the client's recent latencies
+ * (see also \ref OA_HTTP_HEDGE_DELAY), a second copy is signed with
+ * a new nonce and timestamp and sent as well, so the provider does not
+ * reject it as replay. The first reply wins and the other transfer is
+ * cancelled. The second copy is also sent immediately if the first one
+ * fails with a transport error.
+ *
+ * Only use this for requests that may be executed twice.
+ *
+ * @param c client to use; it keeps track of the latencies
+ * @param url URL without OAuth parameters
+ * @param customheader specify custom HTTP header (or NULL for none)
+ * @param auth_header if set, the OAuth parameters are sent in an
+ * Authorization header instead of the query string
+ * @param method signature method
+ * @param c_key consumer key
+ * @param c_secret consumer secret
+ * @param t_key token key (or NULL)
+ * @param t_secret token secret (or NULL)
+ * @return reply (regardless of its HTTP status), or NULL if neither
+ * copy received one. The string needs to be freed by the caller.
+ */
+char *oauth_http_client_get_hedged (oauth_http_client *c, const char *url, const char *customheader, int auth_header, OAuthMethod method, const char *c_key, const char *c_secret, const char *t_key, const char *t_secret);
+
+/**
+ * opaque handle for requests that are driven by an external event
+ * loop, see \ref oauth_http_loop_new
+ */
+typedef struct oauth_http_loop oauth_http_loop;
+
+#define OA_HTTP_POLL_IN     1 ///< wait for the socket to become readable
+#define OA_HTTP_POLL_OUT    2 ///< wait for the socket to become writable
+#define OA_HTTP_POLL_REMOVE 4 ///< stop watching the socket
+#define OA_HTTP_POLL_ERR    8 ///< error condition on the socket (\ref oauth_http_loop_socket_action only)
+
+/**
+ * called whenever the set of events to wait for on a socket changes.
+ *
+ * @param fd the socket
+ * @param what OA_HTTP_POLL_IN and/or OA_HTTP_POLL_OUT, or
+ * OA_HTTP_POLL_REMOVE if the socket is no longer of interest
+ * @param arg user data as passed to \ref oauth_http_loop_new
+ * @return 0 on success, -1 on error
+ */
+typedef int (*oauth_http_socket_cb)(int fd, int what, void *arg);
+
+/**
+ * called whenever the single timer of the loop needs to be (re)set.
+ * When it expires, call \ref oauth_http_loop_timeout.
+ *
+ * @param timeout_ms time until the timer should fire (0: as soon as
+ * possible), or -1 to delete the timer
+ * @param arg user data as passed to \ref oauth_http_loop_new
+ * @return 0 on success, -1 on error
+ */
+typedef int (*oauth_http_timer_cb)(long timeout_ms, void *arg);
+
+/**
+ * create a request queue that is driven by an external event loop
+ * (epoll, libevent, libuv,..) instead of blocking the calling thread.
+ * (requires libcurl)
+ *
+ * liboauth reports the sockets to watch via the socket callback and a
+ * timeout via the timer callback. The application calls
+ * \ref oauth_http_loop_socket_action when a socket is ready and
+ * \ref oauth_http_loop_timeout when the timer expires; completed
+ * requests are passed to their callbacks from within these calls.
+ *
+ * The loop is not thread-safe: all oauth_http_loop_* functions
+ * for a given loop must be called from the same thread.
+ * The limits of the client (\ref oauth_http_client_setopt) apply.
+ *
+ * @param c client whose pooled handles are used
+ * @param socket_cb socket callback
+ * @param timer_cb timer callback
+ * @param arg user data passed to both callbacks
+ * @return the loop that needs to be freed with \ref oauth_http_loop_free,
+ * or NULL on error or if liboauth was compiled without libcurl.
+ */
+oauth_http_loop *oauth_http_loop_new(oauth_http_client *c, oauth_http_socket_cb socket_cb, oauth_http_timer_cb timer_cb, void *arg);
+
+/**
+ * abort all requests that are still in progress (their callbacks are
+ * invoked with an error) and free the loop.
+ * Must not be called from within a callback of the loop.
+ *
+ * @param l loop to free (may be NULL)
+ */
+void oauth_http_loop_free(oauth_http_loop *l);
+
+/**
+ * queue a request. It is started on the next call to
+ * \ref oauth_http_loop_timeout (a timer is scheduled right away), or
+ * - with \ref OA_HTTP_RATE_LIMIT - once its rate limit allows it.
+ * The request and its body must stay valid until the callback
+ * was invoked. The results are stored in the request as with
+ * \ref oauth_http_multi.
+ *
+ * @param l the loop
+ * @param req request to perform
+ * @param done completion callback or NULL
+ * @param done_arg user data passed to the callback
+ * @return 0 on success, -1 if the request could not be queued
+ * (the callback is not invoked in that case).
+ */
+int oauth_http_loop_add(oauth_http_loop *l, oauth_http_request *req, oauth_http_done_cb done, void *done_arg);
+
+/**
+ * process activity on a socket.
+ *
+ * @param l the loop
+ * @param fd the socket that is ready
+ * @param events bitwise OR of OA_HTTP_POLL_IN, OA_HTTP_POLL_OUT, OA_HTTP_POLL_ERR
+ * @return number of requests still in progress, or -1 on error
+ */
+int oauth_http_loop_socket_action(oauth_http_loop *l, int fd, int events);
+
+/**
+ * process timeouts; call this when the timer set by the timer
+ * callback expires.
+ *
+ * @param l the loop
+ * @return number of requests still in progress, or -1 on error
+ */
+int oauth_http_loop_timeout(oauth_http_loop *l);
+
 #ifdef __cplusplus
 }       /* extern "C" */
 #endif  /* __cplusplus */
@@ -30,13 +30,34 @@
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <limits.h>
 
 #ifdef WIN32
 #  define snprintf _snprintf
 #endif
 
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include <time.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <dirent.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
 #include "xmalloc.h"
 #include "oauth.h"
+#include "fileio.h"
+#include "multipart.h"
+#include "http_native.h"
 
 #define OAUTH_USER_AGENT "liboauth-agent/" VERSION
 
@@ -60,38 +81,127 @@
     curl_easy_setopt(curl, CURLOPT_FAILONERROR, (long) atol(getenv("CURLOPT_FAILONERROR")) ); \
   }
 
+/* initial size of response buffers if the length is not known */
+#define OAUTH_HTTP_MIN_BUFSIZ (16*1024)
+/* reply headers can be queried with curl_easy_header() */
+#if LIBCURL_VERSION_NUM >= 0x075400 /* 7.84.0 */
+#define OAUTH_HAVE_CURL_HEADER
+#endif
+
+/* do not trust a Content-Length beyond this for presizing;
+ * larger replies grow the buffer as their data arrives */
+#define OAUTH_HTTP_MAX_PRESIZE (1024*1024)
+/* larger response buffers are freed instead of being pooled */
+#define OAUTH_HTTP_MAX_POOLED_BUFSIZ (4*1024*1024)
+
 struct MemoryStruct {
 	char *data;
 	size_t size; //< bytes remaining (r), bytes accumulated (w)
+	size_t alloc; //< allocated size of data (w)
+	CURL *curl; //< handle to query the Content-Length (w)
+	oauth_http_client *c; //< client whose buffer pool is used (w)
 
 	size_t start_size; //< only used with ..AndCall()
 	void (*callback)(void*,int,size_t,size_t); //< only used with ..AndCall()
 	void *callback_data; //< only used with ..AndCall()
 };
 
+static char *oauth_http_client_buffer_get(oauth_http_client *c, size_t min, size_t *alloc);
+static void oauth_http_client_buffer_put(oauth_http_client *c, char *buf, size_t alloc);
+
+static void oauth_membuf_init(struct MemoryStruct *mem, oauth_http_client *c, CURL *curl) {
+	memset(mem, 0, sizeof(struct MemoryStruct));
+	mem->c = c;
+	mem->curl = curl;
+}
+
+/**
+ * hand the buffer of a failed request back to the pool.
+ */
+static void oauth_membuf_discard(struct MemoryStruct *mem) {
+	if (mem->data && mem->c) oauth_http_client_buffer_put(mem->c, mem->data, mem->alloc);
+	else xfree(mem->data);
+	mem->data = NULL;
+}
+
+/**
+ * size of the buffer to start with: the announced Content-Length
+ * (up to OAUTH_HTTP_MAX_PRESIZE) if there is one, otherwise
+ * OAUTH_HTTP_MIN_BUFSIZ.
+ */
+static size_t oauth_membuf_presize(CURL *curl) {
+#if LIBCURL_VERSION_NUM >= 0x073700 /* 7.55.0 */
+	curl_off_t cl = -1;
+	if (curl) curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &cl);
+#else
+	double cl = -1;
+	if (curl) curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &cl);
+#endif
+	if (cl >= OAUTH_HTTP_MAX_PRESIZE)
+		return OAUTH_HTTP_MAX_PRESIZE;
+	if (cl >= OAUTH_HTTP_MIN_BUFSIZ)
+		return (size_t) cl + 1;
+	return OAUTH_HTTP_MIN_BUFSIZ;
+}
+
 static size_t
 WriteMemoryCallback(void *ptr, size_t size, size_t nmemb, void *data) {
 	size_t realsize = size * nmemb;
 	struct MemoryStruct *mem = (struct MemoryStruct *)data;
+	size_t need = mem->size + realsize + 1;
 
-	mem->data = (char *)xrealloc(mem->data, mem->size + realsize + 1);
-	if (mem->data) {
-		memcpy(&(mem->data[mem->size]), ptr, realsize);
-		mem->size += realsize;
-		mem->data[mem->size] = 0;
+	if (need > mem->alloc) {
+		/* grow geometrically to keep the number of copies low */
+		size_t alloc = mem->alloc * 2;
+		if (!mem->data) {
+			alloc = oauth_membuf_presize(mem->curl);
+			if (alloc < need) alloc = need;
+			if (mem->c) mem->data = oauth_http_client_buffer_get(mem->c, alloc, &mem->alloc);
+		}
+		if (need > mem->alloc) {
+			while (alloc < need) alloc *= 2;
+			mem->data = (char *)xrealloc(mem->data, alloc);
+			mem->alloc = alloc;
+		}
 	}
+	memcpy(&(mem->data[mem->size]), ptr, realsize);
+	mem->size += realsize;
+	mem->data[mem->size] = 0;
 	return realsize;
 }
 
+struct IovStruct {
+	const struct iovec *iov;
+	int iovcnt;
+	int idx; //< current element
+	size_t off; //< offset in current element
+	size_t size; //< bytes remaining
+
+	size_t start_size; //< only used with ..AndCall()
+	void (*callback)(void*,int,size_t,size_t); //< only used with ..AndCall()
+	void *callback_data; //< only used with ..AndCall()
+};
+
 static size_t
-ReadMemoryCallback(void *ptr, size_t size, size_t nmemb, void *data) {
-	struct MemoryStruct *mem = (struct MemoryStruct *)data;
-	size_t realsize = size * nmemb;
-	if (realsize > mem->size) realsize = mem->size;
-	memcpy(ptr, mem->data, realsize);
-	mem->size -= realsize;
-	mem->data += realsize;
-	return realsize;
+ReadIovCallback(void *ptr, size_t size, size_t nmemb, void *data) {
+	struct IovStruct *rd = (struct IovStruct *)data;
+	size_t avail = size * nmemb;
+	size_t written = 0;
+	while (avail > 0 && rd->idx < rd->iovcnt) {
+		const struct iovec *v = &rd->iov[rd->idx];
+		size_t len = v->iov_len - rd->off;
+		if (len > avail) len = avail;
+		memcpy((char*)ptr + written, (const char*)v->iov_base + rd->off, len);
+		written += len;
+		avail -= len;
+		rd->off += len;
+		if (rd->off >= v->iov_len) {
+			rd->idx++;
+			rd->off = 0;
+		}
+	}
+	rd->size -= written;
+	return written;
 }
 
 static size_t
@@ -103,182 +213,3435 @@ WriteMemoryCallbackAndCall(void *ptr, size_t size, size_t nmemb, void *data) {
 }
 
 static size_t
-ReadMemoryCallbackAndCall(void *ptr, size_t size, size_t nmemb, void *data) {
-	struct MemoryStruct *mem = (struct MemoryStruct *)data;
-	size_t ret=ReadMemoryCallback(ptr,size,nmemb,data);
-	mem->callback(mem->callback_data,1,mem->start_size-mem->size,mem->start_size);
+ReadIovCallbackAndCall(void *ptr, size_t size, size_t nmemb, void *data) {
+	struct IovStruct *rd = (struct IovStruct *)data;
+	size_t ret=ReadIovCallback(ptr,size,nmemb,data);
+	rd->callback(rd->callback_data,1,rd->start_size-rd->size,rd->start_size);
 	return ret;
 }
 
+/* connection re-use */
+
+#ifdef HAVE_PTHREAD
+# define OAUTH_LOCK(l)   pthread_mutex_lock(l)
+# define OAUTH_UNLOCK(l) pthread_mutex_unlock(l)
+#else
+# define OAUTH_LOCK(l)
+# define OAUTH_UNLOCK(l)
+#endif
+
+#define OAUTH_HTTP_DEFAULT_MAX_IDLE 8
+#define OAUTH_HTTP_DEFAULT_MAX_HOST_CONNECTIONS 6
+#define OAUTH_HTTP_DEFAULT_MAX_PARALLEL 64
+#define OAUTH_HTTP_DEFAULT_MAX_STREAMS 100
+#define OAUTH_HTTP_DEFAULT_POOLED_BUFFERS 4
+#define OAUTH_HTTP_MAX_POOLED_BUFFERS 16
+#define OAUTH_HTTP_DEFAULT_HEDGE_PERCENTILE 95
+#define OAUTH_HTTP_DEFAULT_HEDGE_DELAY 100 // ms
+#define OAUTH_HTTP_HEDGE_SAMPLES 64
+#define OAUTH_HTTP_RATE_PROBE_TIMEOUT 10000 // ms
+#define OAUTH_HTTP_BUCKET_IDLE 60000 // ms, unused buckets are dropped after this
+#define OAUTH_HTTP_DEFAULT_CACHE_DISK (64*1024*1024)
+
+struct oauth_cache_entry;
+
 /**
- * cURL http post function.
- * the returned string (if not NULL) needs to be freed by the caller
- *
- * @param u url to retrieve
- * @param p post parameters
- * @param customheader specify custom HTTP header (or NULL for none)
- * @return returned HTTP
+ * a GET that is in progress, for \ref OA_HTTP_COALESCE.
+ * Identical requests made meanwhile wait for its reply.
  */
-char *oauth_curl_post (const char *u, const char *p, const char *customheader) {
-	CURL *curl;
-	CURLcode res;
-	struct curl_slist *slist=NULL;
+struct oauth_flight {
+	char *key;       //< normalized request, see oauth_http_request_key
+	int waiters;     //< requests waiting for the reply
+	int done;
+	char *reply;     //< reply (NULL on error), handed to the last waiter
+	size_t len;
+#ifdef HAVE_PTHREAD
+	pthread_cond_t cond;
+#endif
+	struct oauth_flight *next;
+};
 
-	struct MemoryStruct chunk;
-	chunk.data=NULL;
-	chunk.size = 0;
+/**
+ * token bucket, one per host and one per consumer key and host.
+ * The rate starts at the configured value and follows the quota the
+ * provider reports in its reply headers until that quota resets.
+ */
+struct oauth_bucket {
+	char *key;        //< origin, or origin and consumer key
+	int consumer;     //< this is a per-consumer-key bucket
+	double rate;      //< tokens per second (0: unlimited)
+	double burst;     //< capacity of the bucket
+	double tokens;
+	long long last;   //< ms, time of the last refill
+	long long until;  //< ms, no requests before this time (Retry-After, quota exhausted)
+	long long reset;  //< ms, when the rate reported by the provider expires (0: configured rate)
+	int learning;     //< no reply seen yet: a single request probes the quota
+	long long probe;  //< ms, when that request was sent (0: not yet)
+	struct oauth_bucket *next;
+};
 
-	curl = curl_easy_init();
-	if(!curl) return NULL;
-	curl_easy_setopt(curl, CURLOPT_URL, u);
-	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, p);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
-	if (customheader) {
-		slist = curl_slist_append(slist, customheader);
-		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, slist);
+struct oauth_http_client {
+	CURL **idle;      //< stack of idle easy handles
+	char **idle_host; //< origin each idle handle last connected to
+	int n_idle;
+	int max_idle;
+	CURLM *multi;     //< idle multi handle (keeps its connections)
+	long max_host_connections;
+	long max_parallel;
+	long http_version; //< CURL_HTTP_VERSION_*
+	long max_streams;  //< max. concurrent HTTP/2 streams per connection
+	int accept_encoding; //< request compressed responses
+	char *pool[OAUTH_HTTP_MAX_POOLED_BUFFERS]; //< response buffers for reuse
+	size_t pool_size[OAUTH_HTTP_MAX_POOLED_BUFFERS];
+	int n_pool;
+	int max_pool;
+	long hedge_percentile; //< of the latencies below, when to send a hedged request
+	long hedge_delay;      //< ms, before enough latencies were seen, and lower bound
+	long hedge_lat[OAUTH_HTTP_HEDGE_SAMPLES]; //< ring buffer of recent latencies (ms)
+	int n_hedge_lat;
+	int hedge_lat_pos;
+	int rate_limit;     //< pace requests by the buckets below
+	long rate_host;     //< requests/s per host (0: unlimited)
+	long rate_consumer; //< requests/s per consumer key and host (0: unlimited)
+	struct oauth_bucket *buckets;
+	long long buckets_swept; //< ms, last check for idle buckets
+	size_t cache_max;  //< bytes of replies kept in memory (0: no cache)
+	size_t cache_size;
+	char *cache_dir;   //< on-disk tier (or NULL)
+	size_t cache_disk_max;       //< bytes of replies kept in cache_dir
+	long long cache_disk_size;   //< bytes in cache_dir as far as known (-1: not yet counted)
+	struct oauth_cache_entry *cache_head, *cache_tail; //< most recently used first
+	int coalesce;      //< share the reply of identical concurrent GETs
+	struct oauth_flight *flights; //< GETs in progress
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t lock;
+#endif
+};
+
+/**
+ * return "scheme://host:port" part of the given URL.
+ * the returned string needs to be freed by the caller.
+ */
+static char *oauth_http_url_origin(const char *u) {
+	const char *p = strstr(u, "://");
+	size_t len;
+	char *rv;
+	p = p ? p + 3 : u;
+	len = (p - u) + strcspn(p, "/?#");
+	rv = (char*) xmalloc(len + 1);
+	memcpy(rv, u, len);
+	rv[len] = '\0';
+	return rv;
+}
+
+static oauth_http_client *oauth_http_client_create(int max_idle) {
+	oauth_http_client *c = (oauth_http_client*) xcalloc(1, sizeof(oauth_http_client));
+	if (max_idle <= 0) max_idle = OAUTH_HTTP_DEFAULT_MAX_IDLE;
+	c->max_idle = max_idle;
+	c->idle = (CURL**) xcalloc(max_idle, sizeof(CURL*));
+	c->idle_host = (char**) xcalloc(max_idle, sizeof(char*));
+	c->max_host_connections = OAUTH_HTTP_DEFAULT_MAX_HOST_CONNECTIONS;
+	c->max_parallel = OAUTH_HTTP_DEFAULT_MAX_PARALLEL;
+	c->max_pool = OAUTH_HTTP_DEFAULT_POOLED_BUFFERS;
+	c->http_version = CURL_HTTP_VERSION_NONE;
+	c->max_streams = OAUTH_HTTP_DEFAULT_MAX_STREAMS;
+	c->hedge_percentile = OAUTH_HTTP_DEFAULT_HEDGE_PERCENTILE;
+	c->hedge_delay = OAUTH_HTTP_DEFAULT_HEDGE_DELAY;
+	c->cache_disk_max = OAUTH_HTTP_DEFAULT_CACHE_DISK;
+	c->cache_disk_size = -1;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_init(&c->lock, NULL);
+#endif
+	return c;
+}
+
+static void oauth_cache_trim(oauth_http_client *c);
+
+static void oauth_http_client_buckets_clear(oauth_http_client *c) {
+	while (c->buckets) {
+		struct oauth_bucket *b = c->buckets;
+		c->buckets = b->next;
+		xfree(b->key);
+		xfree(b);
 	}
-	curl_easy_setopt(curl, CURLOPT_USERAGENT, OAUTH_USER_AGENT);
-#ifdef OAUTH_CURL_TIMEOUT
-	curl_easy_setopt(curl, CURLOPT_TIMEOUT, OAUTH_CURL_TIMEOUT);
-	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
+}
+
+void oauth_http_client_free(oauth_http_client *c) {
+	int i;
+	if (!c) return;
+	for (i=0; i < c->n_idle; i++) {
+		curl_easy_cleanup(c->idle[i]);
+		xfree(c->idle_host[i]);
+	}
+	for (i=0; i < c->n_pool; i++) {
+		xfree(c->pool[i]);
+	}
+	oauth_http_client_buckets_clear(c);
+	c->cache_max = 0;
+	oauth_cache_trim(c);
+	xfree(c->cache_dir);
+	if (c->multi) curl_multi_cleanup(c->multi);
+	xfree(c->idle);
+	xfree(c->idle_host);
+#ifdef HAVE_PTHREAD
+	pthread_mutex_destroy(&c->lock);
 #endif
-	GLOBAL_CURL_ENVIROMENT_OPTIONS;
-	res = curl_easy_perform(curl);
-	curl_slist_free_all(slist);
-	if (res) {
-		return NULL;
+	xfree(c);
+}
+
+int oauth_http_client_setopt(oauth_http_client *c, OAuthHttpOption opt, long value) {
+	if (!c) return -1;
+	switch (opt) {
+		case OA_HTTP_MAX_HOST_CONNECTIONS:
+			if (value < 0) return -1;
+			c->max_host_connections = value;
+			break;
+		case OA_HTTP_MAX_PARALLEL:
+			if (value <= 0) return -1;
+			c->max_parallel = value;
+			break;
+		case OA_HTTP_VERSION:
+			switch (value) {
+				case OA_HTTP_VERSION_DEFAULT: c->http_version = CURL_HTTP_VERSION_NONE; break;
+				case OA_HTTP_VERSION_1_1:     c->http_version = CURL_HTTP_VERSION_1_1; break;
+#if LIBCURL_VERSION_NUM >= 0x073100 /* 7.49.0 */
+				case OA_HTTP_VERSION_2:       c->http_version = CURL_HTTP_VERSION_2TLS; break;
+				case OA_HTTP_VERSION_2_PRIOR_KNOWLEDGE: c->http_version = CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE; break;
+#endif
+				default: return -1;
+			}
+			break;
+		case OA_HTTP_MAX_STREAMS:
+			if (value <= 0) return -1;
+			c->max_streams = value;
+			break;
+		case OA_HTTP_ACCEPT_ENCODING:
+			if (value != 0 && value != 1) return -1;
+			c->accept_encoding = (int) value;
+			break;
+		case OA_HTTP_HEDGE_PERCENTILE:
+			if (value < 0 || value > 100) return -1;
+			c->hedge_percentile = value;
+			break;
+		case OA_HTTP_HEDGE_DELAY:
+			if (value < 0) return -1;
+			c->hedge_delay = value;
+			break;
+		case OA_HTTP_RATE_LIMIT:
+			if (value != 0 && value != 1) return -1;
+			c->rate_limit = (int) value;
+			break;
+		case OA_HTTP_RATE_HOST:
+		case OA_HTTP_RATE_CONSUMER:
+			if (value < 0) return -1;
+			if (opt == OA_HTTP_RATE_HOST) c->rate_host = value;
+			else c->rate_consumer = value;
+			OAUTH_LOCK(&c->lock);
+			oauth_http_client_buckets_clear(c); // start over with the new rates
+			OAUTH_UNLOCK(&c->lock);
+			break;
+		case OA_HTTP_CACHE:
+#ifdef OAUTH_HAVE_CURL_HEADER
+			if (value < 0) return -1;
+			OAUTH_LOCK(&c->lock);
+			c->cache_max = (size_t) value;
+			oauth_cache_trim(c);
+			OAUTH_UNLOCK(&c->lock);
+			break;
+#else
+			return -1;
+#endif
+		case OA_HTTP_CACHE_DISK:
+#ifdef OAUTH_HAVE_CURL_HEADER
+			if (value < 0) return -1;
+			OAUTH_LOCK(&c->lock);
+			c->cache_disk_max = (size_t) value;
+			c->cache_disk_size = -1; // checked with the next reply stored
+			OAUTH_UNLOCK(&c->lock);
+			break;
+#else
+			return -1;
+#endif
+		case OA_HTTP_COALESCE:
+#ifdef HAVE_PTHREAD
+			if (value != 0 && value != 1) return -1;
+			c->coalesce = (int) value;
+			break;
+#else
+			return -1;
+#endif
+		case OA_HTTP_POOLED_BUFFERS:
+			if (value < 0 || value > OAUTH_HTTP_MAX_POOLED_BUFFERS) return -1;
+			OAUTH_LOCK(&c->lock);
+			c->max_pool = (int) value;
+			while (c->n_pool > c->max_pool) {
+				xfree(c->pool[--c->n_pool]);
+			}
+			OAUTH_UNLOCK(&c->lock);
+			break;
+		default:
+			return -1;
 	}
+	return 0;
+}
 
-	curl_easy_cleanup(curl);
-	return (chunk.data);
+/**
+ * take the smallest pooled buffer that holds at least min bytes.
+ * @return the buffer (its size is stored in alloc) or NULL
+ */
+static char *oauth_http_client_buffer_get(oauth_http_client *c, size_t min, size_t *alloc) {
+	char *buf = NULL;
+	int i, best = -1;
+	OAUTH_LOCK(&c->lock);
+	for (i=0; i < c->n_pool; i++) {
+		if (c->pool_size[i] >= min && (best < 0 || c->pool_size[i] < c->pool_size[best]))
+			best = i;
+	}
+	if (best >= 0) {
+		buf = c->pool[best];
+		*alloc = c->pool_size[best];
+		c->n_pool--;
+		c->pool[best] = c->pool[c->n_pool];
+		c->pool_size[best] = c->pool_size[c->n_pool];
+	}
+	OAUTH_UNLOCK(&c->lock);
+	return buf;
 }
 
 /**
- * cURL http get function.
- * the returned string (if not NULL) needs to be freed by the caller
- *
- * @param u url to retrieve
- * @param q optional query parameters
- * @param customheader specify custom HTTP header (or NULL for none)
- * @return returned HTTP
+ * keep a buffer for reuse; if the pool is full the smallest
+ * buffer is dropped. Buffers beyond OAUTH_HTTP_MAX_POOLED_BUFSIZ
+ * are freed: a single large reply must not stay pinned in the pool.
  */
-char *oauth_curl_get (const char *u, const char *q, const char *customheader) {
+static void oauth_http_client_buffer_put(oauth_http_client *c, char *buf, size_t alloc) {
+	int i, smallest = -1;
+	if (alloc > OAUTH_HTTP_MAX_POOLED_BUFSIZ) {
+		xfree(buf);
+		return;
+	}
+	OAUTH_LOCK(&c->lock);
+	if (c->n_pool < c->max_pool) {
+		c->pool[c->n_pool] = buf;
+		c->pool_size[c->n_pool] = alloc;
+		c->n_pool++;
+		buf = NULL;
+	} else {
+		for (i=0; i < c->n_pool; i++) {
+			if (smallest < 0 || c->pool_size[i] < c->pool_size[smallest])
+				smallest = i;
+		}
+		if (smallest >= 0 && c->pool_size[smallest] < alloc) {
+			char *tmp = c->pool[smallest];
+			c->pool[smallest] = buf;
+			c->pool_size[smallest] = alloc;
+			buf = tmp;
+		}
+	}
+	OAUTH_UNLOCK(&c->lock);
+	xfree(buf);
+}
+
+void oauth_http_client_recycle(oauth_http_client *c, char *reply) {
+	if (!reply) return;
+	if (!c) {
+		xfree(reply);
+		return;
+	}
+	/* the allocated size is not known, but it is at least this */
+	oauth_http_client_buffer_put(c, reply, strlen(reply) + 1);
+}
+
+/* process-wide DNS and TLS session cache shared by all handles */
+
+static CURLSH *oauth_curl_share = NULL;
+
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t oauth_curl_share_locks[CURL_LOCK_DATA_LAST];
+
+static void oauth_curl_share_lock(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr) {
+	pthread_mutex_lock(&oauth_curl_share_locks[data]);
+}
+
+static void oauth_curl_share_unlock(CURL *handle, curl_lock_data data, void *userptr) {
+	pthread_mutex_unlock(&oauth_curl_share_locks[data]);
+}
+#endif
+
+/**
+ * create the share object; must be called with the
+ * default-client lock held.
+ */
+static void oauth_curl_share_init(void) {
+	if (oauth_curl_share) return;
+	oauth_curl_share = curl_share_init();
+	if (!oauth_curl_share) return;
+#ifdef HAVE_PTHREAD
+	{
+		int i;
+		for (i=0; i < CURL_LOCK_DATA_LAST; i++) {
+			pthread_mutex_init(&oauth_curl_share_locks[i], NULL);
+		}
+	}
+	curl_share_setopt(oauth_curl_share, CURLSHOPT_LOCKFUNC, oauth_curl_share_lock);
+	curl_share_setopt(oauth_curl_share, CURLSHOPT_UNLOCKFUNC, oauth_curl_share_unlock);
+#endif
+	curl_share_setopt(oauth_curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt(oauth_curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+	/* Note: the connection cache (CURL_LOCK_DATA_CONNECT) is not shared,
+	 * libcurl does not support using shared connections from concurrent
+	 * threads. Connections are re-used per pooled handle instead. */
+}
+
+/**
+ * @return 0 on success, -1 if the share is still in use by a client
+ * that has not been freed
+ */
+static int oauth_curl_share_cleanup(void) {
+	if (!oauth_curl_share) return 0;
+	if (curl_share_cleanup(oauth_curl_share) != CURLSHE_OK)
+		return -1;
+	oauth_curl_share = NULL;
+#ifdef HAVE_PTHREAD
+	{
+		int i;
+		for (i=0; i < CURL_LOCK_DATA_LAST; i++) {
+			pthread_mutex_destroy(&oauth_curl_share_locks[i]);
+		}
+	}
+#endif
+	return 0;
+}
+
+/* persistent TLS session cache */
+
+#if LIBCURL_VERSION_NUM >= 0x080c00 // curl_easy_ssls_export, 8.12.0
+# define OAUTH_HAVE_SSLS_EXPORT
+#endif
+
+#define OAUTH_SSLS_HEADER "# liboauth TLS session cache v1\n"
+
+static char *oauth_session_cache_file = NULL;
+
+#ifdef OAUTH_HAVE_SSLS_EXPORT
+/** session export is an optional libcurl build feature */
+static int oauth_ssls_supported(void) {
+	const char * const *f = curl_version_info(CURLVERSION_NOW)->feature_names;
+	for (; f && *f; f++) {
+		if (!strcmp(*f, "SSLS-EXPORT")) return 1;
+	}
+	return 0;
+}
+
+static char *oauth_ssls_encode(const unsigned char *data, size_t len) {
+	if (!data || len == 0) return xstrdup("-");
+	return oauth_encode_base64(len, data);
+}
+
+static unsigned char *oauth_ssls_decode(const char *b64, size_t *len) {
+	unsigned char *rv;
+	*len = 0;
+	if (!strcmp(b64, "-")) return NULL;
+	rv = (unsigned char*) xmalloc(strlen(b64) * 3 / 4 + 4);
+	*len = oauth_decode_base64(rv, b64);
+	return rv;
+}
+
+/**
+ * read a line of arbitrary length; the returned string
+ * needs to be freed by the caller. returns NULL on EOF.
+ */
+static char *oauth_ssls_getline(FILE *f) {
+	size_t alloc = 1024, len = 0;
+	char *line = (char*) xmalloc(alloc);
+	while (fgets(line + len, alloc - len, f)) {
+		len += strlen(line + len);
+		if (len > 0 && line[len-1] == '\n') {
+			line[--len] = '\0';
+			return line;
+		}
+		alloc *= 2;
+		line = (char*) xrealloc(line, alloc);
+	}
+	if (len > 0) return line;
+	xfree(line);
+	return NULL;
+}
+
+static CURLcode oauth_ssls_export_cb(CURL *handle, void *userptr,
+		const char *session_key, const unsigned char *shmac, size_t shmac_len,
+		const unsigned char *sdata, size_t sdata_len, curl_off_t valid_until,
+		int ietf_tls_id, const char *alpn, size_t earlydata_max) {
+	FILE *f = (FILE*) userptr;
+	char *k = oauth_ssls_encode((const unsigned char*) session_key, session_key ? strlen(session_key) : 0);
+	char *h = oauth_ssls_encode(shmac, shmac_len);
+	char *d = oauth_ssls_encode(sdata, sdata_len);
+	fprintf(f, "%" CURL_FORMAT_CURL_OFF_T "\t%s\t%s\t%s\n", valid_until, k, h, d);
+	xfree(k); xfree(h); xfree(d);
+	return CURLE_OK;
+}
+#endif
+
+/**
+ * import TLS sessions from the cache file into the shared session cache.
+ * @return number of sessions imported, -1 on error.
+ */
+static int oauth_session_cache_load(const char *fn) {
+#ifdef OAUTH_HAVE_SSLS_EXPORT
 	CURL *curl;
-	CURLcode res;
-	struct curl_slist *slist=NULL;
-	char *t1=NULL;
-	struct MemoryStruct chunk;
+	FILE *f;
+	char *line;
+	int cnt = 0;
+	curl_off_t now = (curl_off_t) time(NULL);
 
-	if (q) {
-		t1=(char*)xmalloc(sizeof(char)*(strlen(u)+strlen(q)+2));
-		strcpy(t1,u); strcat(t1,"?"); strcat(t1,q);
+	if (!oauth_curl_share || !oauth_ssls_supported()) return -1;
+	f = fopen(fn, "r");
+	if (!f) return 0; // no cache yet
+	curl = curl_easy_init();
+	if (!curl) {
+		fclose(f);
+		return -1;
+	}
+	curl_easy_setopt(curl, CURLOPT_SHARE, oauth_curl_share);
+	while ((line = oauth_ssls_getline(f))) {
+		char *t1, *t2, *t3;
+		if (line[0] != '#'
+				&& (t1 = strchr(line, '\t')) && (t2 = strchr(t1 + 1, '\t')) && (t3 = strchr(t2 + 1, '\t'))) {
+			size_t kl, hl, dl;
+			unsigned char *k, *h, *d;
+			*t1++ = '\0'; *t2++ = '\0'; *t3++ = '\0';
+			if (strtoll(line, NULL, 10) > now) {
+				k = oauth_ssls_decode(t1, &kl);
+				h = oauth_ssls_decode(t2, &hl);
+				d = oauth_ssls_decode(t3, &dl);
+				if (k) k[kl] = '\0';
+				if (d && curl_easy_ssls_import(curl, (const char*) k, h, hl, d, dl) == CURLE_OK) cnt++;
+				xfree(k); xfree(h); xfree(d);
+			}
+		}
+		xfree(line);
 	}
+	curl_easy_cleanup(curl);
+	fclose(f);
+	return cnt;
+#else
+	return -1;
+#endif
+}
 
-	chunk.data=NULL;
-	chunk.size = 0;
+/**
+ * write all sessions of the shared session cache to the cache file.
+ * The file is replaced atomically and only readable by the user.
+ * @return 0 on success, -1 on error.
+ */
+static int oauth_session_cache_save(const char *fn) {
+#ifdef OAUTH_HAVE_SSLS_EXPORT
+	CURL *curl;
+	CURLcode res;
+	FILE *f;
+	int fd;
+	char *tmp;
 
+	if (!oauth_curl_share || !oauth_ssls_supported()) return -1;
+	/* a unique temporary file: processes that exit at the same time
+	 * must not write into each other's copy */
+	tmp = (char*) xmalloc(strlen(fn) + 8);
+	sprintf(tmp, "%s.XXXXXX", fn);
+	fd = mkstemp(tmp); // mode 0600
+	if (fd < 0 || !(f = fdopen(fd, "w"))) {
+		if (fd >= 0) { close(fd); unlink(tmp); }
+		xfree(tmp);
+		return -1;
+	}
 	curl = curl_easy_init();
-	if(!curl) {
-		xfree(t1);
-		return NULL;
+	if (!curl) {
+		fclose(f);
+		unlink(tmp);
+		xfree(tmp);
+		return -1;
 	}
-	curl_easy_setopt(curl, CURLOPT_URL, q?t1:u);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
-	if (customheader) {
-		slist = curl_slist_append(slist, customheader);
-		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, slist);
+	curl_easy_setopt(curl, CURLOPT_SHARE, oauth_curl_share);
+	fputs(OAUTH_SSLS_HEADER, f);
+	res = curl_easy_ssls_export(curl, oauth_ssls_export_cb, f);
+	curl_easy_cleanup(curl);
+	if (fclose(f) || res != CURLE_OK || rename(tmp, fn)) {
+		unlink(tmp);
+		xfree(tmp);
+		return -1;
 	}
-#if 0 // TODO - support request methods..
-	if (0)
-		curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "HEAD");
-	else if (0)
-		curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "DELETE");
+	xfree(tmp);
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+static oauth_http_client *oauth_default_client = NULL;
+static int oauth_curl_initialized = 0; //< curl_global_init() was called
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t oauth_default_client_lock = PTHREAD_MUTEX_INITIALIZER;
 #endif
+
+/**
+ * write the session cache when the process exits, so that programs
+ * which never call oauth_http_global_cleanup() update it as well.
+ */
+static void oauth_session_cache_atexit(void) {
+	OAUTH_LOCK(&oauth_default_client_lock);
+	if (oauth_session_cache_file) oauth_session_cache_save(oauth_session_cache_file);
+	OAUTH_UNLOCK(&oauth_default_client_lock);
+}
+
+/**
+ * set the cache file and load it; must be called with the
+ * default-client lock held.
+ */
+static int oauth_session_cache_set(const char *fn) {
+	static int registered = 0;
+	xfree(oauth_session_cache_file);
+	oauth_session_cache_file = fn ? xstrdup(fn) : NULL;
+	if (!fn) return 0;
+	if (!registered) {
+		atexit(oauth_session_cache_atexit);
+		registered = 1;
+	}
+	return oauth_session_cache_load(fn);
+}
+
+oauth_http_client *oauth_http_client_default(void) {
+	oauth_http_client *c;
+	OAUTH_LOCK(&oauth_default_client_lock);
+	if (!oauth_default_client) {
+		if (!oauth_curl_initialized) {
+			curl_global_init(CURL_GLOBAL_ALL);
+			oauth_curl_initialized = 1;
+		}
+		oauth_curl_share_init();
+		oauth_default_client = oauth_http_client_create(0);
+		if (getenv("OAUTH_HTTP_SESSION_CACHE") && !oauth_session_cache_file)
+			oauth_session_cache_set(getenv("OAUTH_HTTP_SESSION_CACHE"));
+	}
+	c = oauth_default_client;
+	OAUTH_UNLOCK(&oauth_default_client_lock);
+	return c;
+}
+
+oauth_http_client *oauth_http_client_new(int max_idle) {
+	oauth_http_client_default(); // global init and share
+	return oauth_http_client_create(max_idle);
+}
+
+void oauth_http_global_cleanup(void) {
+	OAUTH_LOCK(&oauth_default_client_lock);
+	if (oauth_default_client) {
+		if (oauth_session_cache_file) {
+			oauth_session_cache_save(oauth_session_cache_file);
+			xfree(oauth_session_cache_file);
+			oauth_session_cache_file = NULL;
+		}
+		oauth_http_client_free(oauth_default_client);
+		oauth_default_client = NULL;
+		/* libcurl must not be torn down while a client created with
+		 * oauth_http_client_new() still has handles; the share is then
+		 * kept as well and used again by the next default client */
+		if (!oauth_curl_share_cleanup()) {
+			curl_global_cleanup();
+			oauth_curl_initialized = 0;
+		}
+	}
+	OAUTH_UNLOCK(&oauth_default_client_lock);
+}
+
+int oauth_http_session_cache(const char *filename) {
+	int rv;
+	oauth_http_client_default(); // global init and share
+	OAUTH_LOCK(&oauth_default_client_lock);
+	rv = oauth_session_cache_set(filename);
+	OAUTH_UNLOCK(&oauth_default_client_lock);
+	return rv;
+}
+
+int oauth_http_session_cache_flush(void) {
+	int rv = -1;
+	OAUTH_LOCK(&oauth_default_client_lock);
+	if (oauth_session_cache_file) rv = oauth_session_cache_save(oauth_session_cache_file);
+	OAUTH_UNLOCK(&oauth_default_client_lock);
+	return rv;
+}
+
+/**
+ * take an easy handle from the pool. A handle that last talked to
+ * the same origin is preferred: its connection cache most likely
+ * still holds an open (keep-alive) connection to that host.
+ */
+static CURL *oauth_http_client_acquire(oauth_http_client *c, const char *u) {
+	CURL *curl = NULL;
+	char *origin = oauth_http_url_origin(u);
+	int i;
+
+	OAUTH_LOCK(&c->lock);
+	if (c->n_idle > 0) {
+		for (i = c->n_idle - 1; i >= 0; i--) {
+			if (!strcmp(c->idle_host[i], origin)) break;
+		}
+		if (i < 0) i = c->n_idle - 1; // most recently used
+		curl = c->idle[i];
+		xfree(c->idle_host[i]);
+		c->n_idle--;
+		memmove(&c->idle[i], &c->idle[i+1], (c->n_idle - i) * sizeof(CURL*));
+		memmove(&c->idle_host[i], &c->idle_host[i+1], (c->n_idle - i) * sizeof(char*));
+	}
+	OAUTH_UNLOCK(&c->lock);
+	xfree(origin);
+
+	if (!curl) {
+		curl = curl_easy_init();
+		/* the share is kept by curl_easy_reset(), set it once */
+		if (curl && oauth_curl_share) curl_easy_setopt(curl, CURLOPT_SHARE, oauth_curl_share);
+	}
+	return curl;
+}
+
+/**
+ * return an easy handle to the pool. The handle's options are reset,
+ * but live connections, DNS and TLS session caches are kept.
+ */
+static void oauth_http_client_release(oauth_http_client *c, CURL *curl, const char *u) {
+	curl_easy_reset(curl);
+	OAUTH_LOCK(&c->lock);
+	if (c->n_idle < c->max_idle) {
+		c->idle[c->n_idle] = curl;
+		c->idle_host[c->n_idle] = oauth_http_url_origin(u);
+		c->n_idle++;
+		curl = NULL;
+	}
+	OAUTH_UNLOCK(&c->lock);
+	if (curl) curl_easy_cleanup(curl);
+}
+
+/**
+ * set options common to all requests.
+ */
+static void oauth_curl_setopt_common(oauth_http_client *c, CURL *curl) {
 	curl_easy_setopt(curl, CURLOPT_USERAGENT, OAUTH_USER_AGENT);
+	if (c->http_version != CURL_HTTP_VERSION_NONE)
+		curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, c->http_version);
+	/* "" offers every encoding libcurl was built with; the body is
+	 * decoded on the fly before it reaches the write callback. */
+	if (c->accept_encoding)
+#if LIBCURL_VERSION_NUM >= 0x071506 /* 7.21.6 */
+		curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+#else
+		curl_easy_setopt(curl, CURLOPT_ENCODING, "");
+#endif
 #ifdef OAUTH_CURL_TIMEOUT
 	curl_easy_setopt(curl, CURLOPT_TIMEOUT, OAUTH_CURL_TIMEOUT);
-	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
 #endif
 	GLOBAL_CURL_ENVIROMENT_OPTIONS;
-	res = curl_easy_perform(curl);
-	curl_slist_free_all(slist);
-	xfree(t1);
-	curl_easy_cleanup(curl);
+}
 
-	if (res) {
-		return NULL;
+/**
+ * set the request method and (optional) in-memory body.
+ *
+ * @param method HTTP verb; NULL: "POST" if body is set, "GET" otherwise
+ */
+static void oauth_curl_setopt_method(CURL *curl, const char *method, const char *body, size_t len) {
+	if (!method) method = body ? "POST" : "GET";
+	if (!strcmp(method, "HEAD")) {
+		curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+	} else if (strcmp(method, "GET") || body) {
+		if (body || !strcmp(method, "POST")) {
+			curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t) (body ? len : 0));
+			curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body ? body : "");
+		}
+		if (strcmp(method, "POST"))
+			curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, method);
 	}
-	return (chunk.data);
 }
 
-/**
- * cURL http post raw data from file.
- * the returned string needs to be freed by the caller
- *
- * @param u url to retrieve
- * @param fn filename of the file to post along (max 2GB)
- * @param len length of the file in bytes. set to '0' for autodetection
- * @param customheader specify custom HTTP header (or NULL for default)
- *        the default header adds "Content-Type: image/jpeg;"
- * @return returned HTTP or NULL on error
- */
-char *oauth_curl_post_file (const char *u, const char *fn, size_t len, const char *customheader) {
-	CURL *curl;
-	CURLcode res;
-	struct curl_slist *slist=NULL;
-	struct MemoryStruct chunk;
-	FILE *f;
-	long filelen;
+static long long oauth_http_now(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (long long) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+/* identity of a request */
+
+/**
+ * find an OAuth parameter (e.g. the consumer key) of a signed request,
+ * in the query string or the Authorization header.
+ * @return its (escaped) value, to be freed by the caller, or NULL
+ */
+static char *oauth_http_request_param(const char *u, const char *customheader, const char *name) {
+	const char *p = strchr(u, '?');
+	size_t nl = strlen(name);
+	size_t len;
+	char *rv;
+
+	while (p && (p = strstr(p, name))) {
+		if ((p[-1] == '?' || p[-1] == '&') && p[nl] == '=') {
+			p += nl + 1;
+			len = strcspn(p, "&#");
+			goto found;
+		}
+		p++;
+	}
+	for (p = customheader; p && (p = strstr(p, name)); p++) {
+		if (p > customheader && (p[-1] == ' ' || p[-1] == ',') && p[nl] == '=' && p[nl+1] == '"') {
+			p += nl + 2;
+			len = strcspn(p, "\"");
+			goto found;
+		}
+	}
+	return NULL;
+found:
+	rv = (char*) xmalloc(len + 1);
+	memcpy(rv, p, len);
+	rv[len] = '\0';
+	return rv;
+}
+
+/**
+ * normalized form of a request: the URL with its parameters sorted and
+ * without the parameters that change with every signature (nonce,
+ * timestamp, signature), the consumer key and token - also if they
+ * are sent in the Authorization header - and the other custom headers.
+ * Requests with the same key ask the same question.
+ * @return key, to be freed by the caller
+ */
+static char *oauth_http_request_key(const char *u, const char *customheader) {
+	char **argv = NULL;
+	char *q, *ck, *tk, *rv;
+	const char *h;
+	size_t len;
+	int i, argc;
+
+	argc = oauth_split_url_parameters(u, &argv); // drops oauth_signature
+	for (i = argc - 1; i > 0; i--) {
+		if (strncmp(argv[i], "oauth_nonce=", 12) && strncmp(argv[i], "oauth_timestamp=", 16)) continue;
+		xfree(argv[i]);
+		memmove(&argv[i], &argv[i+1], (argc - i - 1) * sizeof(char*));
+		argc--;
+	}
+	if (argc > 2) qsort(&argv[1], argc - 1, sizeof(char*), oauth_cmpstringp);
+	q = oauth_serialize_url_sep(argc, 0, argv, "&", 0);
+	oauth_free_array(&argc, &argv);
+
+	ck = oauth_http_request_param("", customheader, "oauth_consumer_key");
+	tk = oauth_http_request_param("", customheader, "oauth_token");
+	len = strlen(q) + (ck ? strlen(ck) : 0) + (tk ? strlen(tk) : 0) + (customheader ? strlen(customheader) + 1 : 0) + 4;
+	rv = (char*) xmalloc(len);
+	sprintf(rv, "%s\n%s\n%s\n", q, ck ? ck : "", tk ? tk : "");
+	/* other header lines, without Authorization */
+	for (h = customheader; h && *h; ) {
+		size_t l = strcspn(h, "\r\n");
+		if (l > 0 && strncasecmp(h, "Authorization:", 14)) {
+			strncat(rv, h, l);
+			strcat(rv, "\n");
+		}
+		h += l;
+		h += strspn(h, "\r\n");
+	}
+	xfree(q);
+	xfree(ck);
+	xfree(tk);
+	return rv;
+}
+
+/**
+ * value of a header of the last reply received by the handle.
+ * @return the value (owned by curl) or NULL if it is not present or
+ * libcurl is too old to tell
+ */
+static const char *oauth_curl_header(CURL *curl, const char *name) {
+#ifdef OAUTH_HAVE_CURL_HEADER
+	struct curl_header *h;
+	if (curl_easy_header(curl, name, 0, CURLH_HEADER, -1, &h) == CURLHE_OK)
+		return h->value;
+#endif
+	return NULL;
+}
+
+/* rate limiting */
+
+/**
+ * look up or create a bucket; the client must be locked.
+ */
+static struct oauth_bucket *oauth_bucket_get(oauth_http_client *c, const char *key, int consumer, long long now) {
+	struct oauth_bucket *b;
+	for (b = c->buckets; b; b = b->next) {
+		if (!strcmp(b->key, key)) return b;
+	}
+	b = (struct oauth_bucket*) xcalloc(1, sizeof(struct oauth_bucket));
+	b->key = xstrdup(key);
+	b->consumer = consumer;
+	b->rate = consumer ? c->rate_consumer : c->rate_host;
+	b->burst = b->rate > 1 ? b->rate : 1;
+	b->tokens = b->burst;
+	b->last = now;
+	b->learning = 1;
+	b->next = c->buckets;
+	c->buckets = b;
+	return b;
+}
+
+/**
+ * drop the buckets that were not used for a while and hold nothing a
+ * new bucket would not start with, so the table does not grow with
+ * every host ever contacted; the client must be locked.
+ */
+static void oauth_bucket_expire(oauth_http_client *c, long long now) {
+	struct oauth_bucket **p = &c->buckets;
+	if (now - c->buckets_swept < 1000) return;
+	c->buckets_swept = now;
+	while (*p) {
+		struct oauth_bucket *b = *p;
+		if (now - b->last >= OAUTH_HTTP_BUCKET_IDLE && b->until <= now && b->reset <= now) {
+			*p = b->next;
+			xfree(b->key);
+			xfree(b);
+		} else {
+			p = &b->next;
+		}
+	}
+}
+
+static void oauth_bucket_refill(oauth_http_client *c, struct oauth_bucket *b, long long now) {
+	if (b->reset && now >= b->reset) {
+		/* the provider's window is over: back to the configured rate
+		 * until the next reply tells the new quota */
+		b->reset = 0;
+		b->rate = b->consumer ? c->rate_consumer : c->rate_host;
+		b->burst = b->rate > 1 ? b->rate : 1;
+		b->tokens = 1;
+		b->learning = 1;
+		b->probe = 0;
+	}
+	if (b->rate > 0) {
+		b->tokens += (now - b->last) * b->rate / 1000.0;
+		if (b->tokens > b->burst) b->tokens = b->burst;
+	}
+	b->last = now;
+}
+
+/**
+ * get the buckets a request is subject to; the client must be locked.
+ * @param ck escaped consumer key the request is signed with (or NULL)
+ * @return number of buckets (1 or 2)
+ */
+static int oauth_ratelimit_buckets(oauth_http_client *c, const char *u, const char *ck, long long now, struct oauth_bucket **b) {
+	char *origin = oauth_http_url_origin(u);
+	int n = 0;
+
+	oauth_bucket_expire(c, now);
+	b[n++] = oauth_bucket_get(c, origin, 0, now);
+	if (ck) {
+		char *key = (char*) xmalloc(strlen(origin) + strlen(ck) + 2);
+		sprintf(key, "%s %s", origin, ck);
+		b[n++] = oauth_bucket_get(c, key, 1, now);
+		xfree(key);
+	}
+	xfree(origin);
+	return n;
+}
+
+/**
+ * take a token for a request from its buckets.
+ * @param ck escaped consumer key the request is signed with (or NULL)
+ * @return 0 if the request may be sent now, otherwise the time in ms
+ * to wait before trying again (no token was taken then)
+ */
+static long oauth_ratelimit_take_key(oauth_http_client *c, const char *u, const char *ck) {
+	struct oauth_bucket *b[2];
+	long long now, wait = 0;
+	int i, n;
+
+	if (!c->rate_limit) return 0;
+	now = oauth_http_now();
+	OAUTH_LOCK(&c->lock);
+	n = oauth_ratelimit_buckets(c, u, ck, now, b);
+	for (i = 0; i < n; i++) {
+		long long w = 0;
+		oauth_bucket_refill(c, b[i], now);
+		if (b[i]->until > now)
+			w = b[i]->until - now;
+		else if (b[i]->learning && b[i]->probe && now - b[i]->probe < OAUTH_HTTP_RATE_PROBE_TIMEOUT)
+			w = 10; // wait for the reply of the first request
+		else if (b[i]->rate > 0 && b[i]->tokens < 1)
+			w = (long long) ((1 - b[i]->tokens) * 1000 / b[i]->rate) + 1;
+		if (w > wait) wait = w;
+	}
+	if (wait == 0) {
+		for (i = 0; i < n; i++) {
+			if (b[i]->rate > 0) b[i]->tokens -= 1;
+			if (b[i]->learning) b[i]->probe = now;
+		}
+	}
+	OAUTH_UNLOCK(&c->lock);
+	return (long) wait;
+}
+
+/**
+ * take a token for a signed request, see oauth_ratelimit_take_key.
+ */
+static long oauth_ratelimit_take(oauth_http_client *c, const char *u, const char *customheader) {
+	char *ck;
+	long wait;
+	if (!c->rate_limit) return 0;
+	ck = oauth_http_request_param(u, customheader, "oauth_consumer_key");
+	wait = oauth_ratelimit_take_key(c, u, ck);
+	xfree(ck);
+	return wait;
+}
+
+/**
+ * read the first of the given reply headers that is present.
+ * @return its value or -1
+ */
+static long long oauth_ratelimit_header(CURL *curl, const char *const *names) {
+	const char *v;
+	for (; *names; names++) {
+		if ((v = oauth_curl_header(curl, *names)))
+			return strtoll(v, NULL, 10);
+	}
+	return -1;
+}
+
+/**
+ * adapt the buckets of a request to the reply: Retry-After and the
+ * remaining quota (X-RateLimit-Remaining/-Reset, or the RateLimit-*
+ * fields of the IETF draft). The remaining quota is spread evenly over
+ * the rest of the window, so requests are paced instead of running
+ * into the limit.
+ * @param ck escaped consumer key the request is signed with (or NULL)
+ */
+static void oauth_ratelimit_update_key(oauth_http_client *c, CURL *curl, const char *u, const char *ck) {
+	static const char *const rem[] = { "X-RateLimit-Remaining", "X-Rate-Limit-Remaining", "RateLimit-Remaining", NULL };
+	static const char *const rst[] = { "X-RateLimit-Reset", "X-Rate-Limit-Reset", "RateLimit-Reset", NULL };
+	struct oauth_bucket *b[2], *bk;
+	long long now, remaining = -1, reset = -1, retry = -1;
+	long status = 0;
+	int i, n;
+
+	if (!c->rate_limit) return;
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+#if LIBCURL_VERSION_NUM >= 0x074200 /* 7.66.0 */
+	{
+		curl_off_t ra = 0;
+		if (curl_easy_getinfo(curl, CURLINFO_RETRY_AFTER, &ra) == CURLE_OK && ra > 0) retry = ra;
+	}
+#endif
+	remaining = oauth_ratelimit_header(curl, rem);
+	reset = oauth_ratelimit_header(curl, rst);
+
+	now = oauth_http_now();
+	OAUTH_LOCK(&c->lock);
+	n = oauth_ratelimit_buckets(c, u, ck, now, b);
+	for (i = 0; i < n; i++) b[i]->learning = 0;
+	if (retry < 0 && remaining < 0 && status != 429) {
+		OAUTH_UNLOCK(&c->lock);
+		return;
+	}
+	bk = b[n - 1]; // quotas are usually per application
+	oauth_bucket_refill(c, bk, now);
+
+	if (remaining >= 0 && reset >= 0) {
+		long configured = bk->consumer ? c->rate_consumer : c->rate_host;
+		/* the reset is either a unix time or a number of seconds */
+		reset = reset > 1000000000LL ? reset * 1000 : now + reset * 1000;
+		if (remaining == 0) {
+			if (reset > bk->until) bk->until = reset;
+		} else if (reset > now) {
+			bk->rate = remaining * 1000.0 / (reset - now);
+			if (configured > 0 && bk->rate > configured) bk->rate = configured;
+			bk->burst = bk->rate > 1 ? bk->rate : 1;
+			if (bk->burst > remaining) bk->burst = remaining;
+			if (bk->tokens > bk->burst) bk->tokens = bk->burst;
+			bk->reset = reset;
+		}
+	}
+	if (retry >= 0) {
+		if (now + retry * 1000 > bk->until) bk->until = now + retry * 1000;
+	} else if (status == 429 && bk->until <= now) {
+		/* throttled without a hint: slow down */
+		bk->until = now + 1000;
+		if (bk->rate > 0) {
+			bk->rate /= 2;
+			bk->burst = 1;
+			bk->tokens = 0;
+			bk->reset = now + 60000;
+		}
+	}
+	/* learn the new quota when the pause is over */
+	if (bk->until > bk->reset) bk->reset = bk->until;
+	OAUTH_UNLOCK(&c->lock);
+}
+
+static void oauth_ratelimit_update(oauth_http_client *c, CURL *curl, const char *u, const char *customheader) {
+	char *ck;
+	if (!c->rate_limit) return;
+	ck = oauth_http_request_param(u, customheader, "oauth_consumer_key");
+	oauth_ratelimit_update_key(c, curl, u, ck);
+	xfree(ck);
+}
+
+/**
+ * perform a blocking request, paced by the rate limiter.
+ */
+static CURLcode oauth_curl_perform(oauth_http_client *c, CURL *curl, const char *u, const char *customheader) {
+	CURLcode res;
+	long wait;
+	while ((wait = oauth_ratelimit_take(c, u, customheader)) > 0)
+		usleep((wait > 1000 ? 1000 : wait) * 1000);
+	res = curl_easy_perform(curl);
+	oauth_ratelimit_update(c, curl, u, customheader);
+	return res;
+}
+
+/* conditional GET cache */
+
+struct oauth_cache_entry {
+	char *key;           //< see oauth_http_request_key
+	char *etag;          //< validators of the cached reply (or NULL)
+	char *last_modified;
+	char *data;          //< reply body, '\0' terminated
+	size_t len;
+	int refs;            //< requests using the entry
+	int evicted;         //< no longer in the cache; freed with the last reference
+	struct oauth_cache_entry *prev, *next;
+};
+
+static size_t oauth_cache_entry_size(struct oauth_cache_entry *e) {
+	return sizeof(struct oauth_cache_entry) + strlen(e->key) + e->len;
+}
+
+static void oauth_cache_entry_free(struct oauth_cache_entry *e) {
+	xfree(e->key);
+	xfree(e->etag);
+	xfree(e->last_modified);
+	xfree(e->data);
+	xfree(e);
+}
+
+/**
+ * remove an entry from the cache; the client must be locked.
+ */
+static void oauth_cache_unlink(oauth_http_client *c, struct oauth_cache_entry *e) {
+	if (e->prev) e->prev->next = e->next;
+	else c->cache_head = e->next;
+	if (e->next) e->next->prev = e->prev;
+	else c->cache_tail = e->prev;
+	e->prev = e->next = NULL;
+	c->cache_size -= oauth_cache_entry_size(e);
+	e->evicted = 1;
+	if (e->refs == 0) oauth_cache_entry_free(e);
+}
+
+/**
+ * evict the least recently used entries until the cache fits;
+ * the client must be locked.
+ */
+static void oauth_cache_trim(oauth_http_client *c) {
+	while (c->cache_tail && c->cache_size > c->cache_max)
+		oauth_cache_unlink(c, c->cache_tail);
+}
+
+/**
+ * add an entry (replacing one with the same key);
+ * the client must be locked.
+ */
+static void oauth_cache_insert(oauth_http_client *c, struct oauth_cache_entry *e) {
+	struct oauth_cache_entry *o;
+	for (o = c->cache_head; o; o = o->next) {
+		if (!strcmp(o->key, e->key)) {
+			oauth_cache_unlink(c, o);
+			break;
+		}
+	}
+	e->next = c->cache_head;
+	if (c->cache_head) c->cache_head->prev = e;
+	c->cache_head = e;
+	if (!c->cache_tail) c->cache_tail = e;
+	c->cache_size += oauth_cache_entry_size(e);
+	oauth_cache_trim(c);
+}
+
+/**
+ * name of the file that holds the reply of a request in the on-disk
+ * tier: a FNV-1a hash of the key; the key itself is stored in the file.
+ */
+static char *oauth_cache_path(const char *dir, const char *key) {
+	unsigned long long h = 0xcbf29ce484222325ULL;
+	char *rv;
+	for (; *key; key++) {
+		h ^= (unsigned char) *key;
+		h *= 0x100000001b3ULL;
+	}
+	rv = (char*) xmalloc(strlen(dir) + 32);
+	sprintf(rv, "%s/liboauth-%016llx", dir, h);
+	return rv;
+}
+
+/**
+ * read a reply from the on-disk tier. The file starts with a line
+ * "liboauth-cache 1 <key> <etag> <last-modified> <body>" giving the
+ * length of each of the following parts.
+ */
+static struct oauth_cache_entry *oauth_cache_load(const char *dir, const char *key) {
+	struct oauth_cache_entry *e = NULL;
+	size_t kl, el, ll, bl;
+	char *fn, *k = NULL;
+	FILE *f;
+
+	fn = oauth_cache_path(dir, key);
+	if (!(f = fopen(fn, "rb"))) {
+		xfree(fn);
+		return NULL;
+	}
+	if (fscanf(f, "liboauth-cache 1 %zu %zu %zu %zu", &kl, &el, &ll, &bl) != 4 || fgetc(f) != '\n')
+		goto looser;
+	if (kl != strlen(key) || el > 4096 || ll > 4096) goto looser;
+	k = (char*) xmalloc(kl + 1);
+	if (fread(k, 1, kl, f) != kl || memcmp(k, key, kl)) goto looser;
+
+	e = (struct oauth_cache_entry*) xcalloc(1, sizeof(struct oauth_cache_entry));
+	e->key = xstrdup(key);
+	e->etag = el ? (char*) xcalloc(1, el + 1) : NULL;
+	e->last_modified = ll ? (char*) xcalloc(1, ll + 1) : NULL;
+	e->data = (char*) xmalloc(bl + 1);
+	e->data[bl] = '\0';
+	e->len = bl;
+	if ((el && fread(e->etag, 1, el, f) != el) || (ll && fread(e->last_modified, 1, ll, f) != ll)
+			|| fread(e->data, 1, bl, f) != bl) {
+		oauth_cache_entry_free(e);
+		e = NULL;
+	}
+	if (e) utimes(fn, NULL); // recently used, see oauth_cache_disk_trim
+looser:
+	xfree(fn);
+	xfree(k);
+	fclose(f);
+	return e;
+}
+
+struct oauth_cache_file {
+	char *name;
+	time_t mtime;
+	off_t size;
+};
+
+static int oauth_cache_file_cmp(const void *a, const void *b) {
+	time_t x = ((const struct oauth_cache_file*)a)->mtime;
+	time_t y = ((const struct oauth_cache_file*)b)->mtime;
+	return x < y ? -1 : x > y;
+}
+
+/**
+ * remove the least recently used replies from the on-disk tier until
+ * it fits: files are refreshed when they are written or loaded, so
+ * their modification time tells their last use.
+ * @return bytes left in the directory
+ */
+static long long oauth_cache_disk_trim(const char *dir, size_t max) {
+	struct oauth_cache_file *files = NULL;
+	struct dirent *de;
+	long long total = 0;
+	int i, n = 0, alloc = 0;
+	DIR *d;
+
+	if (!(d = opendir(dir))) return 0;
+	while ((de = readdir(d))) {
+		struct stat st;
+		char *fn;
+		/* only the replies, see oauth_cache_path */
+		if (strncmp(de->d_name, "liboauth-", 9) || strlen(de->d_name) != 25
+				|| strspn(de->d_name + 9, "0123456789abcdef") != 16)
+			continue;
+		fn = (char*) xmalloc(strlen(dir) + strlen(de->d_name) + 2);
+		sprintf(fn, "%s/%s", dir, de->d_name);
+		if (stat(fn, &st) || !S_ISREG(st.st_mode)) {
+			xfree(fn);
+			continue;
+		}
+		if (n == alloc) {
+			alloc = alloc * 2 + 64;
+			files = (struct oauth_cache_file*) xrealloc(files, alloc * sizeof(struct oauth_cache_file));
+		}
+		files[n].name = fn;
+		files[n].mtime = st.st_mtime;
+		files[n].size = st.st_size;
+		total += st.st_size;
+		n++;
+	}
+	closedir(d);
+
+	if (total > (long long) max) {
+		qsort(files, n, sizeof(struct oauth_cache_file), oauth_cache_file_cmp);
+		for (i = 0; i < n && total > (long long) max; i++) {
+			if (!unlink(files[i].name) || errno == ENOENT)
+				total -= files[i].size;
+		}
+	}
+	for (i = 0; i < n; i++) xfree(files[i].name);
+	xfree(files);
+	return total;
+}
+
+/**
+ * write a reply to the on-disk tier; the file is replaced atomically.
+ * The oldest replies are removed when the directory grows beyond
+ * the limit of the client.
+ */
+static void oauth_cache_save(oauth_http_client *c, const char *dir, struct oauth_cache_entry *e) {
+	size_t el = e->etag ? strlen(e->etag) : 0;
+	size_t ll = e->last_modified ? strlen(e->last_modified) : 0;
+	size_t max;
+	long long used, written = 0, replaced = 0;
+	struct stat st;
+	char *fn, *tmp;
+	FILE *f;
+	int fd, ok;
+
+	fn = oauth_cache_path(dir, e->key);
+	tmp = (char*) xmalloc(strlen(fn) + 8);
+	sprintf(tmp, "%s.XXXXXX", fn);
+	if ((fd = mkstemp(tmp)) < 0 || !(f = fdopen(fd, "wb"))) {
+		if (fd >= 0) { close(fd); unlink(tmp); }
+		xfree(tmp);
+		xfree(fn);
+		return;
+	}
+	ok = fprintf(f, "liboauth-cache 1 %zu %zu %zu %zu\n", strlen(e->key), el, ll, e->len) > 0
+		&& fwrite(e->key, 1, strlen(e->key), f) == strlen(e->key)
+		&& fwrite(e->etag ? e->etag : "", 1, el, f) == el
+		&& fwrite(e->last_modified ? e->last_modified : "", 1, ll, f) == ll
+		&& fwrite(e->data, 1, e->len, f) == e->len;
+	if (ok) written = ftell(f);
+	if (!stat(fn, &st)) replaced = st.st_size;
+	if (fclose(f) || !ok || rename(tmp, fn)) {
+		unlink(tmp);
+		written = replaced = 0;
+	}
+	xfree(tmp);
+	xfree(fn);
+
+	OAUTH_LOCK(&c->lock);
+	if (c->cache_disk_size >= 0) c->cache_disk_size += written - replaced;
+	used = c->cache_disk_size;
+	max = c->cache_disk_max;
+	OAUTH_UNLOCK(&c->lock);
+	if (used >= 0 && used <= (long long) max) return;
+	/* count what is there (also written by other clients) and trim */
+	used = oauth_cache_disk_trim(dir, max);
+	OAUTH_LOCK(&c->lock);
+	c->cache_disk_size = used;
+	OAUTH_UNLOCK(&c->lock);
+}
+
+/**
+ * look up the cached reply of a request, in memory first, then on
+ * disk. The entry must be handed back with oauth_cache_put().
+ */
+static struct oauth_cache_entry *oauth_cache_get(oauth_http_client *c, const char *key) {
+	struct oauth_cache_entry *e;
+	char *dir = NULL;
+
+	OAUTH_LOCK(&c->lock);
+	for (e = c->cache_head; e; e = e->next) {
+		if (strcmp(e->key, key)) continue;
+		if (e != c->cache_head) { // move to the front
+			e->prev->next = e->next;
+			if (e->next) e->next->prev = e->prev;
+			else c->cache_tail = e->prev;
+			e->prev = NULL;
+			e->next = c->cache_head;
+			c->cache_head->prev = e;
+			c->cache_head = e;
+		}
+		e->refs++;
+		OAUTH_UNLOCK(&c->lock);
+		return e;
+	}
+	if (c->cache_dir) dir = xstrdup(c->cache_dir);
+	OAUTH_UNLOCK(&c->lock);
+
+	if (!dir) return NULL;
+	e = oauth_cache_load(dir, key);
+	xfree(dir);
+	if (!e) return NULL;
+	OAUTH_LOCK(&c->lock);
+	e->refs++;
+	oauth_cache_insert(c, e);
+	OAUTH_UNLOCK(&c->lock);
+	return e;
+}
+
+static void oauth_cache_put(oauth_http_client *c, struct oauth_cache_entry *e) {
+	if (!e) return;
+	OAUTH_LOCK(&c->lock);
+	if (--e->refs == 0 && e->evicted) oauth_cache_entry_free(e);
+	OAUTH_UNLOCK(&c->lock);
+}
+
+/**
+ * prepare a GET request for the cache: look up a previous reply and
+ * make the request conditional on its validators.
+ * @return the cached entry or NULL (and the request key in *key)
+ */
+static struct oauth_cache_entry *oauth_cache_prepare(oauth_http_client *c, const char *u, const char *customheader, char **key, struct curl_slist **slist) {
+	struct oauth_cache_entry *e;
+	char *h;
+
+	*key = NULL;
+	if (!c->cache_max) return NULL;
+	*key = oauth_http_request_key(u, customheader);
+	if (!(e = oauth_cache_get(c, *key))) return NULL;
+	if (e->etag) {
+		h = (char*) xmalloc(strlen(e->etag) + 16);
+		sprintf(h, "If-None-Match: %s", e->etag);
+		*slist = curl_slist_append(*slist, h);
+		xfree(h);
+	}
+	if (e->last_modified) {
+		h = (char*) xmalloc(strlen(e->last_modified) + 20);
+		sprintf(h, "If-Modified-Since: %s", e->last_modified);
+		*slist = curl_slist_append(*slist, h);
+		xfree(h);
+	}
+	return e;
+}
+
+/**
+ * handle the reply to a cacheable request: serve "304 Not Modified"
+ * from the cache, and remember replies that carry a validator.
+ * The entry is handed back.
+ * @return 1 if the reply was replaced by the cached one
+ */
+static int oauth_cache_reply(oauth_http_client *c, CURL *curl, const char *key, struct oauth_cache_entry *e, struct MemoryStruct *chunk) {
+	struct oauth_cache_entry *n;
+	const char *etag, *lm, *cc;
+	char *dir = NULL;
+	long status = 0;
+	int rv = 0;
+
+	if (!key) return 0;
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+	if (status == 304 && e) {
+		oauth_membuf_discard(chunk);
+		chunk->data = (char*) xmalloc(e->len + 1);
+		memcpy(chunk->data, e->data, e->len + 1);
+		chunk->size = e->len;
+		chunk->alloc = e->len + 1;
+		rv = 1;
+	} else if (status == 200) {
+		etag = oauth_curl_header(curl, "ETag");
+		lm = oauth_curl_header(curl, "Last-Modified");
+		cc = oauth_curl_header(curl, "Cache-Control");
+		if ((etag || lm) && !(cc && strstr(cc, "no-store"))) {
+			n = (struct oauth_cache_entry*) xcalloc(1, sizeof(struct oauth_cache_entry));
+			n->key = xstrdup(key);
+			n->etag = etag ? xstrdup(etag) : NULL;
+			n->last_modified = lm ? xstrdup(lm) : NULL;
+			n->len = chunk->data ? chunk->size : 0;
+			n->data = (char*) xmalloc(n->len + 1);
+			if (n->len) memcpy(n->data, chunk->data, n->len);
+			n->data[n->len] = '\0';
+			OAUTH_LOCK(&c->lock);
+			if (c->cache_dir && c->cache_disk_max) dir = xstrdup(c->cache_dir);
+			n->refs++;
+			oauth_cache_insert(c, n);
+			OAUTH_UNLOCK(&c->lock);
+			if (dir) oauth_cache_save(c, dir, n);
+			xfree(dir);
+			oauth_cache_put(c, n);
+		}
+	}
+	oauth_cache_put(c, e);
+	return rv;
+}
+
+int oauth_http_client_cache_dir(oauth_http_client *c, const char *dir) {
+	struct stat st;
+	if (!c) return -1;
+	if (dir && (stat(dir, &st) || !S_ISDIR(st.st_mode))) return -1;
+	OAUTH_LOCK(&c->lock);
+	xfree(c->cache_dir);
+	c->cache_dir = dir ? xstrdup(dir) : NULL;
+	c->cache_disk_size = -1;
+	OAUTH_UNLOCK(&c->lock);
+	return 0;
+}
+
+/**
+ * http post function using a pooled connection.
+ * the returned string (if not NULL) needs to be freed by the caller
+ *
+ * @param c client (connection pool) to use
+ * @param u url to retrieve
+ * @param p post parameters
+ * @param customheader specify custom HTTP header (or NULL for none)
+ * @return returned HTTP
+ */
+char *oauth_http_client_post (oauth_http_client *c, const char *u, const char *p, const char *customheader) {
+	CURL *curl;
+	CURLcode res;
+	struct curl_slist *slist=NULL;
+
+	struct MemoryStruct chunk;
+
+	curl = oauth_http_client_acquire(c, u);
+	if(!curl) return NULL;
+	oauth_membuf_init(&chunk, c, curl);
+	curl_easy_setopt(curl, CURLOPT_URL, u);
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, p);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
+	if (customheader) {
+		slist = curl_slist_append(slist, customheader);
+		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, slist);
+	}
+	oauth_curl_setopt_common(c, curl);
+	res = oauth_curl_perform(c, curl, u, customheader);
+	oauth_http_client_release(c, curl, u);
+	curl_slist_free_all(slist);
+	if (res) {
+		oauth_membuf_discard(&chunk);
+		return NULL;
+	}
+	return (chunk.data);
+}
+
+/**
+ * GET a resource with a pooled connection.
+ * @param len set to the length of the reply, which may contain '\0'
+ */
+static char *oauth_http_client_fetch (oauth_http_client *c, const char *u, const char *q, const char *customheader, size_t *len) {
+	CURL *curl;
+	CURLcode res;
+	struct curl_slist *slist=NULL;
+	char *t1=NULL;
+	struct MemoryStruct chunk;
+	struct oauth_cache_entry *ce;
+	char *ckey;
+
+	if (q) {
+		t1=(char*)xmalloc(sizeof(char)*(strlen(u)+strlen(q)+2));
+		strcpy(t1,u); strcat(t1,"?"); strcat(t1,q);
+	}
+
+	curl = oauth_http_client_acquire(c, u);
+	if(!curl) {
+		xfree(t1);
+		return NULL;
+	}
+	oauth_membuf_init(&chunk, c, curl);
+	curl_easy_setopt(curl, CURLOPT_URL, q?t1:u);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
+	ce = oauth_cache_prepare(c, q?t1:u, customheader, &ckey, &slist);
+	if (customheader)
+		slist = curl_slist_append(slist, customheader);
+	if (slist)
+		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, slist);
+#if 0 // TODO - support request methods..
+	if (0)
+		curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "HEAD");
+	else if (0)
+		curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "DELETE");
+#endif
+	oauth_curl_setopt_common(c, curl);
+	res = oauth_curl_perform(c, curl, q?t1:u, customheader);
+	if (!res) oauth_cache_reply(c, curl, ckey, ce, &chunk);
+	else oauth_cache_put(c, ce);
+	oauth_http_client_release(c, curl, u);
+	curl_slist_free_all(slist);
+	xfree(ckey);
+	xfree(t1);
+
+	if (res) {
+		oauth_membuf_discard(&chunk);
+		*len = 0;
+		return NULL;
+	}
+	*len = chunk.data ? chunk.size : 0;
+	return (chunk.data);
+}
+
+#ifdef HAVE_PTHREAD
+/**
+ * single-flight GET: the first of several identical concurrent requests
+ * is sent, the others wait for its reply and get a copy of it.
+ * Their own signatures are not used.
+ */
+static char *oauth_http_client_get_coalesced (oauth_http_client *c, const char *u, const char *q, const char *customheader) {
+	struct oauth_flight *f, **fp;
+	char *t1=NULL, *key, *rv;
+	size_t len;
+
+	if (q) {
+		t1=(char*)xmalloc(sizeof(char)*(strlen(u)+strlen(q)+2));
+		strcpy(t1,u); strcat(t1,"?"); strcat(t1,q);
+	}
+	key = oauth_http_request_key(q?t1:u, customheader);
+	xfree(t1);
+
+	OAUTH_LOCK(&c->lock);
+	for (f = c->flights; f; f = f->next) {
+		if (!strcmp(f->key, key)) break;
+	}
+	if (f) {
+		/* follower: wait for the reply of the request in progress */
+		xfree(key);
+		f->waiters++;
+		while (!f->done) pthread_cond_wait(&f->cond, &c->lock);
+		if (--f->waiters > 0) {
+			rv = NULL;
+			if (f->reply) {
+				rv = (char*) xmalloc(f->len + 1);
+				memcpy(rv, f->reply, f->len + 1);
+			}
+			OAUTH_UNLOCK(&c->lock);
+			return rv;
+		}
+		rv = f->reply; // the last one takes it
+		OAUTH_UNLOCK(&c->lock);
+		pthread_cond_destroy(&f->cond);
+		xfree(f->key);
+		xfree(f);
+		return rv;
+	}
+	f = (struct oauth_flight*) xcalloc(1, sizeof(struct oauth_flight));
+	f->key = key;
+	pthread_cond_init(&f->cond, NULL);
+	f->next = c->flights;
+	c->flights = f;
+	OAUTH_UNLOCK(&c->lock);
+
+	rv = oauth_http_client_fetch(c, u, q, customheader, &len);
+
+	OAUTH_LOCK(&c->lock);
+	for (fp = &c->flights; *fp != f; fp = &(*fp)->next) ;
+	*fp = f->next;
+	f->done = 1;
+	if (f->waiters > 0) {
+		if (rv) {
+			f->len = len;
+			f->reply = (char*) xmalloc(len + 1);
+			memcpy(f->reply, rv, len);
+			f->reply[len] = '\0';
+		}
+		pthread_cond_broadcast(&f->cond);
+		OAUTH_UNLOCK(&c->lock);
+		return rv;
+	}
+	OAUTH_UNLOCK(&c->lock);
+	pthread_cond_destroy(&f->cond);
+	xfree(f->key);
+	xfree(f);
+	return rv;
+}
+#endif
+
+/**
+ * http get function using a pooled connection.
+ * the returned string (if not NULL) needs to be freed by the caller
+ *
+ * @param c client (connection pool) to use
+ * @param u url to retrieve
+ * @param q optional query parameters
+ * @param customheader specify custom HTTP header (or NULL for none)
+ * @return returned HTTP
+ */
+char *oauth_http_client_get (oauth_http_client *c, const char *u, const char *q, const char *customheader) {
+	size_t len;
+#ifdef HAVE_PTHREAD
+	if (c->coalesce) return oauth_http_client_get_coalesced(c, u, q, customheader);
+#endif
+	return oauth_http_client_fetch(c, u, q, customheader, &len);
+}
+
+struct FileStruct {
+	fileio_reader *rd;
+	off_t sent; //< bytes handed to curl
+	int error;
+
+	size_t start_size; //< only used with ..AndCall()
+	void (*callback)(void*,int,size_t,size_t); //< only used with ..AndCall()
+	void *callback_data; //< only used with ..AndCall()
+};
+
+static size_t
+ReadFileCallback(void *ptr, size_t size, size_t nmemb, void *data) {
+	struct FileStruct *fs = (struct FileStruct *)data;
+	size_t avail = size * nmemb;
+	size_t written = 0;
+	/* fill curl's upload buffer straight from the mapped file */
+	while (written < avail) {
+		ssize_t len = fileio_read(fs->rd, (char*)ptr + written, avail - written);
+		if (len < 0) {
+			fs->error = 1;
+			return CURL_READFUNC_ABORT;
+		}
+		if (len == 0) break;
+		written += len;
+	}
+	fs->sent += written;
+	return written;
+}
+
+static size_t
+ReadFileCallbackAndCall(void *ptr, size_t size, size_t nmemb, void *data) {
+	struct FileStruct *fs = (struct FileStruct *)data;
+	size_t ret=ReadFileCallback(ptr,size,nmemb,data);
+	if (ret != CURL_READFUNC_ABORT)
+		fs->callback(fs->callback_data,1,(size_t) fs->sent,fs->start_size);
+	return ret;
+}
+
+/**
+ * upload a file as request body. The file is read with
+ * fileio_read(): mmap()ed if possible, sizes are 64bit.
+ */
+static char *oauth_http_client_upload (oauth_http_client *c, const char *u, const char *fn, off_t len, const char *customheader, void (*callback)(void*,int,size_t,size_t), void *callback_data, const char *httpMethod) {
+	CURL *curl;
+	CURLcode res;
+	struct curl_slist *slist=NULL;
+	struct MemoryStruct chunk;
+	struct FileStruct fs;
+
+	fs.rd = fileio_open(fn, len);
+	if (!fs.rd) return NULL;
+	fs.sent = 0;
+	fs.error = 0;
+	fs.start_size = (size_t) fileio_size(fs.rd);
+	fs.callback = callback;
+	fs.callback_data = callback_data;
+
+	curl = oauth_http_client_acquire(c, u);
+	if(!curl) {
+		fileio_close(fs.rd);
+		return NULL;
+	}
+	oauth_membuf_init(&chunk, c, curl);
+	chunk.callback=callback;
+	chunk.callback_data=callback_data;
+
+	if (customheader)
+		slist = curl_slist_append(slist, customheader);
+	else
+		slist = curl_slist_append(slist, "Content-Type: image/jpeg;"); // good guess :)
+
+	curl_easy_setopt(curl, CURLOPT_URL, u);
+	curl_easy_setopt(curl, CURLOPT_POST, 1L);
+	if (httpMethod) curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, httpMethod);
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t) fileio_size(fs.rd));
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, slist);
+#if LIBCURL_VERSION_NUM >= 0x073e00 /* 7.62.0 */
+	curl_easy_setopt(curl, CURLOPT_UPLOAD_BUFFERSIZE, 2L*1024*1024);
+#endif
+	curl_easy_setopt(curl, CURLOPT_READDATA, (void *)&fs);
+	if (callback)
+		curl_easy_setopt(curl, CURLOPT_READFUNCTION, ReadFileCallbackAndCall);
+	else
+		curl_easy_setopt(curl, CURLOPT_READFUNCTION, ReadFileCallback);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
+	if (callback)
+		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallbackAndCall);
+	else
+		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
+	oauth_curl_setopt_common(c, curl);
+	res = oauth_curl_perform(c, curl, u, customheader);
+	oauth_http_client_release(c, curl, u);
+	curl_slist_free_all(slist);
+	fileio_close(fs.rd);
+	if (res || fs.error) {
+		// error
+		oauth_membuf_discard(&chunk);
+		return NULL;
+	}
+	return (chunk.data);
+}
+
+/**
+ * http post raw data from file using a pooled connection.
+ * the returned string needs to be freed by the caller
+ *
+ * @param c client (connection pool) to use
+ * @param u url to retrieve
+ * @param fn filename of the file to post along
+ * @param len length of the file in bytes. set to '0' for autodetection
+ * @param customheader specify custom HTTP header (or NULL for default)
+ *        the default header adds "Content-Type: image/jpeg;"
+ * @return returned HTTP or NULL on error
+ */
+char *oauth_http_client_post_file (oauth_http_client *c, const char *u, const char *fn, size_t len, const char *customheader) {
+	return oauth_http_client_upload(c, u, fn, (off_t) len, customheader, NULL, NULL, NULL);
+}
+
+/**
+ * http send the content of a file, with callback, using a pooled
+ * connection.
+ * the returned string needs to be freed by the caller
+ *
+ * more documentation in oauth.h
+ */
+char *oauth_http_client_send_file (oauth_http_client *c, const char *u, const char *fn, const char *customheader, void (*callback)(void*,int,size_t,size_t), void *callback_data, const char *httpMethod) {
+	return oauth_http_client_upload(c, u, fn, 0, customheader, callback, callback_data, httpMethod);
+}
+
+struct MultipartStruct {
+	mpart_reader *rd;
+	size_t sent; //< bytes handed to curl
+	size_t total;
+	int error;
+	void (*callback)(void*,int,size_t,size_t);
+	void *callback_data;
+};
+
+static size_t
+ReadMultipartCallback(void *ptr, size_t size, size_t nmemb, void *data) {
+	struct MultipartStruct *ms = (struct MultipartStruct *)data;
+	ssize_t len = mpart_read(ms->rd, (char*)ptr, size * nmemb);
+	if (len < 0) {
+		ms->error = 1;
+		return CURL_READFUNC_ABORT;
+	}
+	ms->sent += len;
+	if (ms->callback)
+		ms->callback(ms->callback_data, 1, ms->sent, ms->total);
+	return len;
+}
+
+/**
+ * http send a multipart/form-data body, with callback, using a pooled
+ * connection. The body is serialized into curl's upload buffer.
+ * the returned string needs to be freed by the caller
+ *
+ * more documentation in oauth.h
+ */
+char *oauth_http_client_send_multipart (oauth_http_client *c, const char *u, oauth_multipart *mp, const char *customheader, void (*callback)(void*,int,size_t,size_t), void *callback_data, const char *httpMethod) {
+	CURL *curl;
+	CURLcode res;
+	struct curl_slist *slist=NULL;
+	struct MemoryStruct chunk;
+	struct MultipartStruct ms;
+	char *ctype;
+	long long len = oauth_multipart_length(mp);
+
+	if (len < 0) return NULL;
+	ms.rd = mpart_open(mp);
+	if (!ms.rd) return NULL;
+	ms.sent = 0;
+	ms.total = (size_t) len;
+	ms.error = 0;
+	ms.callback = callback;
+	ms.callback_data = callback_data;
+
+	curl = oauth_http_client_acquire(c, u);
+	if(!curl) {
+		mpart_close(ms.rd);
+		return NULL;
+	}
+	oauth_membuf_init(&chunk, c, curl);
+	chunk.callback=callback;
+	chunk.callback_data=callback_data;
+
+	ctype = (char*) xmalloc(strlen(oauth_multipart_content_type(mp)) + 16);
+	sprintf(ctype, "Content-Type: %s", oauth_multipart_content_type(mp));
+	slist = curl_slist_append(slist, ctype);
+	xfree(ctype);
+	if (customheader)
+		slist = curl_slist_append(slist, customheader);
+
+	curl_easy_setopt(curl, CURLOPT_URL, u);
+	curl_easy_setopt(curl, CURLOPT_POST, 1L);
+	if (httpMethod) curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, httpMethod);
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t) len);
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, slist);
+#if LIBCURL_VERSION_NUM >= 0x073e00 /* 7.62.0 */
+	curl_easy_setopt(curl, CURLOPT_UPLOAD_BUFFERSIZE, 2L*1024*1024);
+#endif
+	curl_easy_setopt(curl, CURLOPT_READDATA, (void *)&ms);
+	curl_easy_setopt(curl, CURLOPT_READFUNCTION, ReadMultipartCallback);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
+	if (callback)
+		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallbackAndCall);
+	else
+		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
+	oauth_curl_setopt_common(c, curl);
+	res = oauth_curl_perform(c, curl, u, customheader);
+	oauth_http_client_release(c, curl, u);
+	curl_slist_free_all(slist);
+	mpart_close(ms.rd);
+	if (res || ms.error) {
+		// error
+		oauth_membuf_discard(&chunk);
+		return NULL;
+	}
+	return (chunk.data);
+}
+
+/**
+ * http send raw data from several buffers, with callback, using a
+ * pooled connection.
+ * the returned string needs to be freed by the caller
+ *
+ * more documentation in oauth.h
+ *
+ * @param c client (connection pool) to use
+ * @param u url to retrieve
+ * @param iov array of buffers to send along
+ * @param iovcnt number of elements in iov
+ * @param customheader specify custom HTTP header (or NULL for default)
+ *        the default header adds "Content-Type: image/jpeg;"
+ * @param callback specify the callback function
+ * @param callback_data specify data to pass to the callback function
+ * @return returned HTTP reply or NULL on error
+ */
+char *oauth_http_client_send_iov (oauth_http_client *c, const char *u, const struct iovec *iov, int iovcnt, const char *customheader, void (*callback)(void*,int,size_t,size_t), void *callback_data, const char *httpMethod) {
+	CURL *curl;
+	CURLcode res;
+	struct curl_slist *slist=NULL;
+	struct MemoryStruct chunk;
+	struct IovStruct rdnfo;
+	size_t len=0;
+	int i;
+
+	for (i=0; i<iovcnt; i++) len+=iov[i].iov_len;
+
+	rdnfo.iov=iov;
+	rdnfo.iovcnt=iovcnt;
+	rdnfo.idx=0;
+	rdnfo.off=0;
+	rdnfo.size=len;
+	rdnfo.start_size=len;
+	rdnfo.callback=callback;
+	rdnfo.callback_data=callback_data;
+
+	curl = oauth_http_client_acquire(c, u);
+	if(!curl) return NULL;
+	oauth_membuf_init(&chunk, c, curl);
+	chunk.callback=callback;
+	chunk.callback_data=callback_data;
+
+	if (customheader)
+		slist = curl_slist_append(slist, customheader);
+	else
+		slist = curl_slist_append(slist, "Content-Type: image/jpeg;");
+
+	curl_easy_setopt(curl, CURLOPT_URL, u);
+	curl_easy_setopt(curl, CURLOPT_POST, 1L);
+	if (httpMethod) curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, httpMethod);
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t) len);
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, slist);
+	curl_easy_setopt(curl, CURLOPT_READDATA, (void *)&rdnfo);
+	if (callback)
+		curl_easy_setopt(curl, CURLOPT_READFUNCTION, ReadIovCallbackAndCall);
+	else
+		curl_easy_setopt(curl, CURLOPT_READFUNCTION, ReadIovCallback);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
+	if (callback)
+		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallbackAndCall);
+	else
+		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
+	oauth_curl_setopt_common(c, curl);
+	res = oauth_curl_perform(c, curl, u, customheader);
+	oauth_http_client_release(c, curl, u);
+	curl_slist_free_all(slist);
+	if (res) {
+		// error
+		oauth_membuf_discard(&chunk);
+		return NULL;
+	}
+
+	return (chunk.data);
+}
+
+/* streaming responses */
+
+struct SinkStruct {
+	oauth_http_sink *sink;
+	CURL *curl;
+};
+
+static size_t
+WriteSinkCallback(void *ptr, size_t size, size_t nmemb, void *data) {
+	struct SinkStruct *st = (struct SinkStruct *)data;
+	oauth_http_sink *sink = st->sink;
+	size_t realsize = size * nmemb;
+	const char *p = (const char*) ptr;
+	size_t left = realsize;
+
+	if (sink->status == 0)
+		curl_easy_getinfo(st->curl, CURLINFO_RESPONSE_CODE, &sink->status);
+
+	if (sink->write) {
+		return sink->write(p, realsize, sink->arg) ? 0 : realsize;
+	}
+	while (left > 0) {
+		ssize_t w = write(sink->fd, p, left);
+		if (w < 0) {
+			if (errno == EINTR) continue;
+			return 0;
+		}
+		p += w;
+		left -= w;
+	}
+	return realsize;
+}
+
+static size_t
+HeaderSinkCallback(void *ptr, size_t size, size_t nmemb, void *data) {
+	struct SinkStruct *st = (struct SinkStruct *)data;
+	oauth_http_sink *sink = st->sink;
+	size_t realsize = size * nmemb;
+	size_t len = realsize;
+	const char *line = (const char*) ptr;
+
+	/* the status line of each response (redirects, 100-continue) */
+	if (len > 5 && !strncmp(line, "HTTP/", 5)) {
+		curl_easy_getinfo(st->curl, CURLINFO_RESPONSE_CODE, &sink->status);
+	}
+	while (len > 0 && (line[len-1] == '\r' || line[len-1] == '\n')) len--;
+	if (sink->header && len > 0) {
+		if (sink->header(line, len, sink->arg)) return 0;
+	}
+	return realsize;
+}
+
+int oauth_http_client_stream (oauth_http_client *c, const char *u, const char *httpMethod, const char *body, size_t len, const char *customheader, oauth_http_sink *sink) {
+	CURL *curl;
+	CURLcode res;
+	struct curl_slist *slist=NULL;
+	struct SinkStruct st;
+
+	if (!c || !sink) return -1;
+	sink->status = 0;
+
+	curl = oauth_http_client_acquire(c, u);
+	if(!curl) return CURLE_FAILED_INIT;
+	st.sink = sink;
+	st.curl = curl;
+
+	curl_easy_setopt(curl, CURLOPT_URL, u);
+	oauth_curl_setopt_method(curl, httpMethod, body, len);
+	if (customheader) {
+		slist = curl_slist_append(slist, customheader);
+		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, slist);
+	}
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&st);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteSinkCallback);
+	curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void *)&st);
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, HeaderSinkCallback);
+	oauth_curl_setopt_common(c, curl);
+	res = oauth_curl_perform(c, curl, u, customheader);
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &sink->status);
+	oauth_http_client_release(c, curl, u);
+	curl_slist_free_all(slist);
+	return (int) res;
+}
+
+/* concurrent requests via curl_multi */
+
+struct oauth_http_xfer {
+	oauth_http_request *req;
+	CURL *curl;
+	struct curl_slist *slist;
+	struct MemoryStruct chunk;
+	char *cache_key;                 //< GET requests with the cache enabled
+	struct oauth_cache_entry *cache; //< previous reply the request is conditional on
+
+	oauth_http_done_cb done; //< only used with oauth_http_loop
+	void *done_arg;
+	struct oauth_http_xfer *prev, *next;
+};
+
+/**
+ * prepare a pooled easy handle for the given request.
+ * @return transfer or NULL if no handle could be allocated.
+ */
+static struct oauth_http_xfer *oauth_http_xfer_new(oauth_http_client *c, oauth_http_request *req) {
+	struct oauth_http_xfer *x;
+	CURL *curl;
+
+	curl = oauth_http_client_acquire(c, req->url);
+	if (!curl) return NULL;
+
+	x = (struct oauth_http_xfer*) xcalloc(1, sizeof(struct oauth_http_xfer));
+	x->req = req;
+	x->curl = curl;
+	oauth_membuf_init(&x->chunk, c, curl);
+
+	curl_easy_setopt(curl, CURLOPT_URL, req->url);
+	oauth_curl_setopt_method(curl, req->method, req->body, req->body_len);
+	if (!req->body && (!req->method || !strcmp(req->method, "GET")))
+		x->cache = oauth_cache_prepare(c, req->url, req->customheader, &x->cache_key, &x->slist);
+	if (req->customheader)
+		x->slist = curl_slist_append(x->slist, req->customheader);
+	if (x->slist)
+		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, x->slist);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&x->chunk);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
+	curl_easy_setopt(curl, CURLOPT_PRIVATE, (void *)x);
+#if LIBCURL_VERSION_NUM >= 0x072b00 /* 7.43.0 */
+	/* rather wait for a connection that can be multiplexed than
+	 * opening another one */
+	if (c->http_version != CURL_HTTP_VERSION_1_1)
+		curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+#endif
+	oauth_curl_setopt_common(c, curl);
+	return x;
+}
+
+/**
+ * store the result of a finished transfer in its request
+ * and return the handle to the pool.
+ */
+static void oauth_http_xfer_done(oauth_http_client *c, struct oauth_http_xfer *x, CURLcode res) {
+	oauth_http_request *req = x->req;
+	long status = 0;
+
+	curl_easy_getinfo(x->curl, CURLINFO_RESPONSE_CODE, &status);
+	req->status = status;
+	req->error = (int) res;
+	oauth_ratelimit_update(c, x->curl, req->url, req->customheader);
+	if (res) {
+		oauth_cache_put(c, x->cache);
+		oauth_membuf_discard(&x->chunk);
+		req->reply = NULL;
+		req->reply_len = 0;
+	} else {
+		if (oauth_cache_reply(c, x->curl, x->cache_key, x->cache, &x->chunk))
+			req->status = 200;
+		req->reply = x->chunk.data;
+		req->reply_len = x->chunk.size;
+	}
+	xfree(x->cache_key);
+	oauth_http_client_release(c, x->curl, req->url);
+	curl_slist_free_all(x->slist);
+	xfree(x);
+}
+
+/**
+ * set the connection limits of the client. Concurrent requests to
+ * the same host are multiplexed over one connection if HTTP/2 is
+ * negotiated.
+ */
+static void oauth_curl_multi_setopt_common(oauth_http_client *c, CURLM *m) {
+	curl_multi_setopt(m, CURLMOPT_MAX_HOST_CONNECTIONS, c->max_host_connections);
+#if LIBCURL_VERSION_NUM >= 0x072b00 /* 7.43.0 */
+	curl_multi_setopt(m, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
+#if LIBCURL_VERSION_NUM >= 0x074300 /* 7.67.0 */
+	curl_multi_setopt(m, CURLMOPT_MAX_CONCURRENT_STREAMS, c->max_streams);
+#endif
+}
+
+/**
+ * take the client's multi handle, or create a new one if it is
+ * in use by another thread.
+ */
+static CURLM *oauth_http_multi_acquire(oauth_http_client *c) {
+	CURLM *m;
+	OAUTH_LOCK(&c->lock);
+	m = c->multi;
+	c->multi = NULL;
+	OAUTH_UNLOCK(&c->lock);
+	if (!m) m = curl_multi_init();
+	if (m) oauth_curl_multi_setopt_common(c, m);
+	return m;
+}
+
+static void oauth_http_multi_release(oauth_http_client *c, CURLM *m) {
+	OAUTH_LOCK(&c->lock);
+	if (!c->multi) {
+		c->multi = m;
+		m = NULL;
+	}
+	OAUTH_UNLOCK(&c->lock);
+	if (m) curl_multi_cleanup(m);
+}
+
+int oauth_http_multi(oauth_http_client *c, oauth_http_request *reqs, int n, oauth_http_done_cb done, void *arg) {
+	struct oauth_http_xfer **xfers;
+	char *started;
+	CURLM *m;
+	CURLMsg *msg;
+	CURLMcode mc = CURLM_OK;
+	int i, next = 0, active = 0, running = 0, failed = 0, left;
+
+	if (!c || n < 0) return -1;
+	m = oauth_http_multi_acquire(c);
+	if (!m) return -1;
+
+	for (i=0; i < n; i++) {
+		reqs[i].reply = NULL;
+		reqs[i].reply_len = 0;
+		reqs[i].status = 0;
+		reqs[i].error = 0;
+	}
+	xfers = (struct oauth_http_xfer**) xcalloc(n > 0 ? n : 1, sizeof(struct oauth_http_xfer*));
+	started = (char*) xcalloc(n > 0 ? n : 1, sizeof(char));
+
+	while (next < n || active > 0) {
+		long wake = 1000;
+		/* keep at most max_parallel transfers in flight; requests whose
+		 * rate limit is exhausted stay queued, the others go ahead */
+		for (i = next; i < n && active < c->max_parallel; i++) {
+			oauth_http_request *req = &reqs[i];
+			struct oauth_http_xfer *x;
+			long wait;
+			if (started[i]) continue;
+			if ((wait = oauth_ratelimit_take(c, req->url, req->customheader)) > 0) {
+				if (wait < wake) wake = wait;
+				continue;
+			}
+			started[i] = 1;
+			x = oauth_http_xfer_new(c, req);
+			if (x && curl_multi_add_handle(m, x->curl) == CURLM_OK) {
+				xfers[i] = x;
+				active++;
+				continue;
+			}
+			if (x) oauth_http_xfer_done(c, x, CURLE_FAILED_INIT);
+			else req->error = CURLE_FAILED_INIT;
+			failed++;
+			if (done) done(req, arg);
+		}
+		while (next < n && started[next]) next++;
+		if (active == 0) {
+			if (next < n) usleep(wake * 1000);
+			continue;
+		}
+
+		if ((mc = curl_multi_perform(m, &running)) != CURLM_OK) break;
+
+		while ((msg = curl_multi_info_read(m, &left))) {
+			struct oauth_http_xfer *x = NULL;
+			oauth_http_request *req;
+			if (msg->msg != CURLMSG_DONE) continue;
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char**) &x);
+			req = x->req;
+			xfers[req - reqs] = NULL;
+			curl_multi_remove_handle(m, x->curl);
+			oauth_http_xfer_done(c, x, msg->data.result);
+			active--;
+			if (req->error) failed++;
+			if (done) done(req, arg);
+		}
+
+		if (running > 0) {
+#if LIBCURL_VERSION_NUM >= 0x074200 /* 7.66.0 */
+			mc = curl_multi_poll(m, NULL, 0, (int) wake, NULL);
+#else
+			mc = curl_multi_wait(m, NULL, 0, (int) wake, NULL);
+#endif
+			if (mc != CURLM_OK) break;
+		}
+	}
+
+	if (mc != CURLM_OK) {
+		/* the multi handle failed: abort everything that is left */
+		for (i=0; i < n; i++) {
+			if (xfers[i]) {
+				curl_multi_remove_handle(m, xfers[i]->curl);
+				oauth_http_xfer_done(c, xfers[i], CURLE_ABORTED_BY_CALLBACK);
+			} else if (!started[i]) {
+				reqs[i].error = CURLE_ABORTED_BY_CALLBACK;
+			} else {
+				continue;
+			}
+			failed++;
+			if (done) done(&reqs[i], arg);
+		}
+		curl_multi_cleanup(m);
+	} else {
+		oauth_http_multi_release(c, m);
+	}
+	xfree(started);
+	xfree(xfers);
+	return failed;
+}
+
+/* chunked uploads */
+
+#define OAUTH_CHUNK_DEFAULT_SIZE (8*1024*1024)
+#define OAUTH_CHUNK_DEFAULT_PARALLEL 4
+#define OAUTH_CHUNK_DEFAULT_RETRIES 3
+#define OAUTH_CHUNK_MAX_BACKOFF 8000 // ms
+
+enum { CHUNK_PENDING = 0, CHUNK_ACTIVE, CHUNK_DONE, CHUNK_FAILED };
+
+struct oauth_chunk {
+	int state;
+	int attempts;
+	long long retry_at; //< ms, see oauth_http_now
+	long long got;      //< bytes received by earlier attempts (downloads)
+	char *body_hash;    //< escaped oauth_body_hash=xxx parameter (cached)
+};
+
+/* the chunk index is an int and the array must fit in a size_t */
+#define OAUTH_CHUNK_MAX_COUNT ((long long) (INT_MAX / sizeof(struct oauth_chunk)))
+
+struct oauth_chunk_xfer {
+	int index;
+	CURL *curl;
+	char *url;
+	struct curl_slist *slist;
+	struct MemoryStruct chunk;
+	struct FileStruct fs;
+};
+
+/**
+ * load the list of completed chunks from the manifest; start a new
+ * manifest if it does not exist or belongs to a different upload.
+ *
+ * The manifest is a text file: a header line identifying the file
+ * (size, modification time) and chunk size, followed by one line with
+ * the index of each completed chunk.
+ *
+ * @return file descriptor to append completed chunks to, or -1 on error
+ */
+static int oauth_chunk_manifest_open(const char *manifest, struct stat *st, size_t chunk_size, struct oauth_chunk *chunks, int n) {
+	char head[128];
+	FILE *f;
+	int fd;
+	snprintf(head, sizeof(head), "liboauth-chunks 1 %lld %lu %ld\n",
+			(long long) st->st_size, (unsigned long) chunk_size, (long) st->st_mtime);
+
+	if ((f = fopen(manifest, "r"))) {
+		char line[128];
+		int i;
+		if (fgets(line, sizeof(line), f) && !strcmp(line, head)) {
+			while (fgets(line, sizeof(line), f)) {
+				if (sscanf(line, "%d", &i) == 1 && i >= 0 && i < n && strchr(line, '\n'))
+					chunks[i].state = CHUNK_DONE;
+			}
+			fclose(f);
+			return open(manifest, O_WRONLY | O_APPEND);
+		}
+		fclose(f);
+	}
+
+	fd = open(manifest, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) return -1;
+	if (write(fd, head, strlen(head)) != (ssize_t) strlen(head)) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void oauth_chunk_manifest_add(int fd, int index) {
+	char line[32];
+	int len;
+	if (fd < 0) return;
+	len = snprintf(line, sizeof(line), "%d\n", index);
+	if (write(fd, line, len) == len)
+		fsync(fd);
+}
+
+/**
+ * calculate the escaped body hash parameter of a part of a file.
+ */
+static char *oauth_chunk_body_hash(const char *filename, off_t offset, off_t len) {
+	const size_t bufsiz = 256 * 1024;
+	oauth_body_hash_ctx *ctx;
+	fileio_reader *rd;
+	char *buf, *bh, *rv = NULL;
+	ssize_t r = 0;
+
+	if (!(rd = fileio_open_range(filename, offset, len))) return NULL;
+	if (!(ctx = oauth_body_hash_init())) {
+		fileio_close(rd);
+		return NULL;
+	}
+	buf = (char*) xmalloc(bufsiz);
+	while ((r = fileio_read(rd, buf, bufsiz)) > 0) {
+		if (oauth_body_hash_update(ctx, buf, r)) { r = -1; break; }
+	}
+	xfree(buf);
+	fileio_close(rd);
+	if (r < 0) {
+		oauth_body_hash_free(ctx);
+		return NULL;
+	}
+	if ((bh = oauth_body_hash_final(ctx))) {
+		char *esc = oauth_url_escape(bh + 16); // skip "oauth_body_hash="
+		rv = (char*) xmalloc(strlen(esc) + 17);
+		sprintf(rv, "oauth_body_hash=%s", esc);
+		xfree(esc);
+		xfree(bh);
+	}
+	return rv;
+}
+
+/**
+ * sign a request with a fresh nonce. With auth_header, the OAuth
+ * parameters are returned as "Authorization:" header in *authheader
+ * and stripped from the URL.
+ * @return signed URL or NULL
+ */
+static char *oauth_http_sign_request(const char *url, const char *method, int auth_header, OAuthMethod sig_method, const char *c_key, const char *c_secret, const char *t_key, const char *t_secret, char **authheader) {
+	int argc;
+	char **argv = NULL;
+	char *hdr, *rv;
+
+	*authheader = NULL;
+	if (!auth_header)
+		return oauth_sign_url2(url, NULL, sig_method, method, c_key, c_secret, t_key, t_secret);
+
+	argc = oauth_split_url_parameters(url, &argv);
+	oauth_sign_array2_process(&argc, &argv, NULL, sig_method, method, c_key, c_secret, t_key, t_secret);
+	rv = oauth_serialize_url_sep(argc, 0, argv, "&", 1);
+	hdr = oauth_serialize_url_sep(argc, 1, argv, ", ", 6);
+	*authheader = (char*) xmalloc(strlen(hdr) + 22);
+	sprintf(*authheader, "Authorization: OAuth %s", hdr);
+	xfree(hdr);
+	oauth_free_array(&argc, &argv);
+	return rv;
+}
+
+/**
+ * build, sign and start the request for a chunk.
+ * @param ck escaped consumer key, for the rate limit
+ * @param wait set to the time in ms until the rate limit allows the
+ * request if it does not yet, otherwise to 0
+ * @return transfer or NULL on error and if the request has to wait
+ */
+static struct oauth_chunk_xfer *oauth_chunk_xfer_new(oauth_http_client *c, const oauth_chunked_upload *up, struct oauth_chunk *ch, int index, off_t total, const char *ck, long *wait) {
+	struct oauth_chunk_xfer *x;
+	off_t offset = (off_t) index * up->chunk_size;
+	size_t len = (total - offset) > (off_t) up->chunk_size ? up->chunk_size : (size_t) (total - offset);
+	const char *method = up->method ? up->method : "POST";
+	char *customheader = NULL;
+	char *url, *signed_url = NULL, *authheader = NULL;
+	CURL *curl;
+
+	url = up->url(index, (long long) offset, len, (long long) total, &customheader, up->arg);
+	if (!url || (*wait = oauth_ratelimit_take_key(c, url, ck)) > 0) {
+		xfree(url);
+		xfree(customheader);
+		return NULL;
+	}
+	if (up->body_hash && !ch->body_hash)
+		ch->body_hash = oauth_chunk_body_hash(up->filename, offset, len);
+	if (up->body_hash && ch->body_hash) {
+		char *tmp = (char*) xmalloc(strlen(url) + strlen(ch->body_hash) + 2);
+		sprintf(tmp, "%s%c%s", url, strchr(url, '?') ? '&' : '?', ch->body_hash);
+		xfree(url);
+		url = tmp;
+	} else if (up->body_hash) {
+		xfree(url);
+		xfree(customheader);
+		return NULL;
+	}
+
+	/* every attempt gets a new nonce and timestamp */
+	signed_url = oauth_http_sign_request(url, method, up->auth_header, up->sig_method,
+			up->c_key, up->c_secret, up->t_key, up->t_secret, &authheader);
+	xfree(url);
+	if (!signed_url) {
+		xfree(customheader);
+		xfree(authheader);
+		return NULL;
+	}
+
+	x = (struct oauth_chunk_xfer*) xcalloc(1, sizeof(struct oauth_chunk_xfer));
+	x->index = index;
+	x->url = signed_url;
+	x->fs.rd = fileio_open_range(up->filename, offset, len);
+	if (!x->fs.rd || fileio_size(x->fs.rd) != (off_t) len || !(curl = oauth_http_client_acquire(c, x->url))) {
+		if (x->fs.rd) fileio_close(x->fs.rd);
+		xfree(x->url);
+		xfree(x);
+		xfree(customheader);
+		xfree(authheader);
+		return NULL;
+	}
+	x->curl = curl;
+	oauth_membuf_init(&x->chunk, c, curl);
+
+	if (authheader) x->slist = curl_slist_append(x->slist, authheader);
+	if (!customheader || !strstr(customheader, "Content-Type:"))
+		x->slist = curl_slist_append(x->slist, "Content-Type: application/octet-stream");
+	if (customheader) x->slist = curl_slist_append(x->slist, customheader);
+	xfree(customheader);
+	xfree(authheader);
+
+	curl_easy_setopt(curl, CURLOPT_URL, x->url);
+	curl_easy_setopt(curl, CURLOPT_POST, 1L);
+	if (strcmp(method, "POST")) curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, method);
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t) len);
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, x->slist);
+	curl_easy_setopt(curl, CURLOPT_READDATA, (void *)&x->fs);
+	curl_easy_setopt(curl, CURLOPT_READFUNCTION, ReadFileCallback);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&x->chunk);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
+	curl_easy_setopt(curl, CURLOPT_PRIVATE, (void *)x);
+#if LIBCURL_VERSION_NUM >= 0x072b00 /* 7.43.0 */
+	if (c->http_version != CURL_HTTP_VERSION_1_1)
+		curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+#endif
+	oauth_curl_setopt_common(c, curl);
+	return x;
+}
+
+static void oauth_chunk_xfer_free(oauth_http_client *c, struct oauth_chunk_xfer *x) {
+	oauth_membuf_discard(&x->chunk);
+	oauth_http_client_release(c, x->curl, x->url);
+	curl_slist_free_all(x->slist);
+	fileio_close(x->fs.rd);
+	xfree(x->url);
+	xfree(x);
+}
+
+/**
+ * a chunk request that failed with one of these may succeed if retried.
+ */
+static int oauth_chunk_retryable(CURLcode res, long status) {
+	if (res) return res != CURLE_ABORTED_BY_CALLBACK;
+	return status >= 500 || status == 408 || status == 429;
+}
+
+int oauth_http_upload_chunks(oauth_http_client *c, const oauth_chunked_upload *upload) {
+	oauth_chunked_upload up;
+	struct oauth_chunk *chunks;
+	struct oauth_chunk_xfer **active;
+	struct stat st;
+	CURLM *m;
+	CURLMsg *msg;
+	CURLMcode mc = CURLM_OK;
+	int i, n, n_active = 0, finished = 0, failed = 0, running = 0, left;
+	int mfd = -1;
+	char *ck;
+
+	if (!c || !upload || !upload->filename || !upload->url) return -1;
+	up = *upload;
+	if (up.chunk_size == 0) up.chunk_size = OAUTH_CHUNK_DEFAULT_SIZE;
+	if (up.parallel <= 0) up.parallel = OAUTH_CHUNK_DEFAULT_PARALLEL;
+	if (up.retries < 0) up.retries = 0;
+	else if (up.retries == 0) up.retries = OAUTH_CHUNK_DEFAULT_RETRIES;
+
+	if (stat(up.filename, &st) || !S_ISREG(st.st_mode)) return -1;
+	if (st.st_size > 0 && (st.st_size - 1) / (long long) up.chunk_size >= OAUTH_CHUNK_MAX_COUNT) return -1;
+	n = st.st_size > 0 ? (int) ((st.st_size - 1) / (long long) up.chunk_size + 1) : 1;
+	chunks = (struct oauth_chunk*) xcalloc(n, sizeof(struct oauth_chunk));
+
+	if (up.manifest && (mfd = oauth_chunk_manifest_open(up.manifest, &st, up.chunk_size, chunks, n)) < 0) {
+		xfree(chunks);
+		return -1;
+	}
+	for (i = 0; i < n; i++)
+		if (chunks[i].state == CHUNK_DONE) finished++;
+
+	m = oauth_http_multi_acquire(c);
+	if (!m) {
+		if (mfd >= 0) close(mfd);
+		xfree(chunks);
+		return -1;
+	}
+	active = (struct oauth_chunk_xfer**) xcalloc(up.parallel, sizeof(struct oauth_chunk_xfer*));
+	ck = up.c_key ? oauth_url_escape(up.c_key) : NULL;
+
+	while (finished + failed < n) {
+		long long now = oauth_http_now();
+		long long wake = now + 1000;
+
+		/* start pending chunks (in order) while there are free slots */
+		for (i = 0; i < n && n_active < up.parallel; i++) {
+			struct oauth_chunk_xfer *x;
+			long wait = 0;
+			int slot;
+			if (chunks[i].state != CHUNK_PENDING) continue;
+			if (chunks[i].retry_at > now) {
+				if (chunks[i].retry_at < wake) wake = chunks[i].retry_at;
+				continue;
+			}
+			x = oauth_chunk_xfer_new(c, &up, &chunks[i], i, st.st_size, ck, &wait);
+			if (!x && wait > 0) {
+				/* no token: the following chunks have to wait as well */
+				if (now + wait < wake) wake = now + wait;
+				break;
+			}
+			chunks[i].attempts++;
+			if (!x || curl_multi_add_handle(m, x->curl) != CURLM_OK) {
+				if (x) oauth_chunk_xfer_free(c, x);
+				chunks[i].state = CHUNK_FAILED;
+				failed++;
+				if (up.done) up.done(i, 0, NULL, 0, up.arg);
+				continue;
+			}
+			for (slot = 0; active[slot]; slot++) ;
+			active[slot] = x;
+			chunks[i].state = CHUNK_ACTIVE;
+			n_active++;
+		}
+
+		if (n_active > 0) {
+			if ((mc = curl_multi_perform(m, &running)) != CURLM_OK) break;
+		}
+
+		while ((msg = curl_multi_info_read(m, &left))) {
+			struct oauth_chunk_xfer *x = NULL;
+			struct oauth_chunk *ch;
+			long status = 0;
+			CURLcode res;
+			if (msg->msg != CURLMSG_DONE) continue;
+			res = msg->data.result;
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char**) &x);
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &status);
+			curl_multi_remove_handle(m, x->curl);
+			for (i = 0; i < up.parallel; i++)
+				if (active[i] == x) active[i] = NULL;
+			n_active--;
+			wake = now; // a slot is free: no need to wait
+			oauth_ratelimit_update_key(c, x->curl, x->url, ck);
+			if (x->fs.error && !res) res = CURLE_READ_ERROR;
+
+			ch = &chunks[x->index];
+			if (!res && status >= 200 && status < 300) {
+				ch->state = CHUNK_DONE;
+				finished++;
+				oauth_chunk_manifest_add(mfd, x->index);
+			} else if (oauth_chunk_retryable(res, status) && ch->attempts <= up.retries) {
+				long long backoff = 500LL << (ch->attempts - 1);
+				ch->state = CHUNK_PENDING;
+				ch->retry_at = oauth_http_now() + (backoff > OAUTH_CHUNK_MAX_BACKOFF ? OAUTH_CHUNK_MAX_BACKOFF : backoff);
+				oauth_chunk_xfer_free(c, x);
+				continue;
+			} else {
+				ch->state = CHUNK_FAILED;
+				failed++;
+			}
+			if (up.done) up.done(x->index, status, res ? NULL : x->chunk.data, res ? 0 : x->chunk.size, up.arg);
+			oauth_chunk_xfer_free(c, x);
+		}
+
+		if (finished + failed >= n) break;
+		now = oauth_http_now();
+		if (n_active > 0 || wake > now) {
+			int timeout = (int) (wake > now ? wake - now : 0);
+#if LIBCURL_VERSION_NUM >= 0x074200 /* 7.66.0 */
+			mc = curl_multi_poll(m, NULL, 0, timeout, NULL);
+#else
+			if (n_active > 0) mc = curl_multi_wait(m, NULL, 0, timeout, NULL);
+			else usleep(timeout * 1000);
+#endif
+			if (mc != CURLM_OK) break;
+		}
+	}
+
+	if (mc != CURLM_OK) {
+		for (i = 0; i < up.parallel; i++) {
+			if (!active[i]) continue;
+			curl_multi_remove_handle(m, active[i]->curl);
+			oauth_chunk_xfer_free(c, active[i]);
+		}
+		for (i = 0; i < n; i++) {
+			if (chunks[i].state == CHUNK_DONE || chunks[i].state == CHUNK_FAILED) continue;
+			failed++;
+			if (up.done) up.done(i, 0, NULL, 0, up.arg);
+		}
+		curl_multi_cleanup(m);
+	} else {
+		oauth_http_multi_release(c, m);
+	}
+
+	if (mfd >= 0) {
+		close(mfd);
+		if (failed == 0) unlink(up.manifest);
+	}
+	for (i = 0; i < n; i++) xfree(chunks[i].body_hash);
+	xfree(chunks);
+	xfree(active);
+	xfree(ck);
+	return failed;
+}
+
+/* parallel ranged downloads */
+
+struct oauth_range_dl {
+	int fd;
+	long long total; //< size of the resource, -1 until known
+	char *etag;      //< strong validator of the first reply, for If-Range
+	int whole;       //< the server ignored the Range header
+};
+
+struct oauth_range_xfer {
+	int index;
+	CURL *curl;
+	char *url;
+	struct curl_slist *slist;
+	struct oauth_range_dl *dl;
+	long long start;  //< first byte requested
+	long long end;    //< one past the last byte requested
+	long long pos;    //< file offset of the next byte received
+	int checked;      //< reply headers were validated
+	int error;        //< the reply does not match the request, or pwrite failed
+	/* parsed reply headers */
+	long long range_start;
+	long long range_total;
+	char *etag;
+};
+
+static size_t
+HeaderRangeCallback(void *ptr, size_t size, size_t nmemb, void *data) {
+	struct oauth_range_xfer *x = (struct oauth_range_xfer *)data;
+	size_t realsize = size * nmemb;
+	char line[256];
+	char *p;
+
+	if (realsize >= sizeof(line)) return realsize;
+	memcpy(line, ptr, realsize);
+	line[realsize] = '\0';
+	for (p = line + realsize; p > line && (p[-1] == '\r' || p[-1] == '\n'); ) *--p = '\0';
+
+	/* the status line of each response (redirects, 100-continue) */
+	if (!strncmp(line, "HTTP/", 5)) {
+		x->range_start = -1;
+		x->range_total = -1;
+		xfree(x->etag);
+		x->etag = NULL;
+	} else if (!strncasecmp(line, "Content-Range:", 14)) {
+		long long a, b, t;
+		for (p = line + 14; *p == ' ' || *p == '\t'; p++) ;
+		if (sscanf(p, "bytes %lld-%lld/%lld", &a, &b, &t) == 3) {
+			x->range_start = a;
+			x->range_total = t;
+		} else if (sscanf(p, "bytes */%lld", &t) == 1) {
+			x->range_total = t;
+		}
+	} else if (!strncasecmp(line, "ETag:", 5)) {
+		for (p = line + 5; *p == ' ' || *p == '\t'; p++) ;
+		xfree(x->etag);
+		x->etag = (*p && strncmp(p, "W/", 2)) ? xstrdup(p) : NULL;
+	}
+	return realsize;
+}
+
+/**
+ * check the reply before its body is written: a range reply must
+ * start where requested and describe the same resource as the first
+ * one. A complete (200) reply is only accepted while the size is not
+ * yet known, i.e. if the server does not support ranges.
+ * The first valid reply sizes the output file.
+ */
+static int oauth_range_check(struct oauth_range_xfer *x, long status) {
+	struct oauth_range_dl *dl = x->dl;
+	if (status == 200) {
+		if (dl->total >= 0 || x->start != 0) return -1;
+		dl->whole = 1;
+		x->end = -1;
+		return 0;
+	}
+	if (status != 206) return -1;
+	if (x->range_start != x->start || x->range_total < 0) return -1;
+	if (dl->total < 0) {
+		dl->total = x->range_total;
+		dl->etag = x->etag;
+		x->etag = NULL;
+		if (ftruncate(dl->fd, (off_t) dl->total)) return -1;
+#ifdef HAVE_POSIX_FALLOCATE
+		if (dl->total > 0) posix_fallocate(dl->fd, 0, (off_t) dl->total);
+#endif
+	} else if (x->range_total != dl->total) {
+		return -1;
+	}
+	if (x->end > dl->total) x->end = dl->total;
+	return 0;
+}
+
+static size_t
+WriteRangeCallback(void *ptr, size_t size, size_t nmemb, void *data) {
+	struct oauth_range_xfer *x = (struct oauth_range_xfer *)data;
+	size_t realsize = size * nmemb;
+	const char *p = (const char*) ptr;
+	size_t left = realsize;
+	long status = 0;
+
+	curl_easy_getinfo(x->curl, CURLINFO_RESPONSE_CODE, &status);
+	if (status < 200 || status >= 300) return realsize; // error page; discard
+	if (!x->checked) {
+		if (oauth_range_check(x, status)) {
+			x->error = 1;
+			return 0;
+		}
+		x->checked = 1;
+	}
+	if (x->end >= 0 && x->pos + (long long) realsize > x->end) {
+		x->error = 1;
+		return 0;
+	}
+	while (left > 0) {
+		ssize_t w = pwrite(x->dl->fd, p, left, (off_t) x->pos);
+		if (w < 0) {
+			if (errno == EINTR) continue;
+			x->error = 1;
+			return 0;
+		}
+		p += w;
+		left -= w;
+		x->pos += w;
+	}
+	return realsize;
+}
+
+/**
+ * sign and prepare the request for (the remainder of) a range.
+ * @return transfer or NULL on error
+ */
+static struct oauth_range_xfer *oauth_range_xfer_new(oauth_http_client *c, const oauth_ranged_download *dl, struct oauth_range_dl *st, struct oauth_chunk *ch, int index) {
+	struct oauth_range_xfer *x;
+	char *authheader = NULL;
+	char range[64];
+	CURL *curl;
+
+	x = (struct oauth_range_xfer*) xcalloc(1, sizeof(struct oauth_range_xfer));
+	x->index = index;
+	x->dl = st;
+	x->start = (long long) index * dl->chunk_size + ch->got;
+	x->end = (long long) (index + 1) * dl->chunk_size;
+	if (st->total >= 0 && x->end > st->total) x->end = st->total;
+	x->pos = x->start;
+	x->range_start = x->range_total = -1;
+
+	/* every attempt gets a new nonce and timestamp */
+	x->url = oauth_http_sign_request(dl->url, "GET", dl->auth_header, dl->sig_method,
+			dl->c_key, dl->c_secret, dl->t_key, dl->t_secret, &authheader);
+	if (!x->url || !(curl = oauth_http_client_acquire(c, x->url))) {
+		xfree(authheader);
+		xfree(x->url);
+		xfree(x);
+		return NULL;
+	}
+	x->curl = curl;
+
+	snprintf(range, sizeof(range), "Range: bytes=%lld-%lld", x->start, x->end - 1);
+	x->slist = curl_slist_append(x->slist, range);
+	if (st->etag) {
+		char *ifrange = (char*) xmalloc(strlen(st->etag) + 11);
+		sprintf(ifrange, "If-Range: %s", st->etag);
+		x->slist = curl_slist_append(x->slist, ifrange);
+		xfree(ifrange);
+	}
+	if (authheader) x->slist = curl_slist_append(x->slist, authheader);
+	if (dl->customheader) x->slist = curl_slist_append(x->slist, dl->customheader);
+	xfree(authheader);
+
+	curl_easy_setopt(curl, CURLOPT_URL, x->url);
+	curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, x->slist);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)x);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteRangeCallback);
+	curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void *)x);
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, HeaderRangeCallback);
+	curl_easy_setopt(curl, CURLOPT_PRIVATE, (void *)x);
+#if LIBCURL_VERSION_NUM >= 0x072b00 /* 7.43.0 */
+	if (c->http_version != CURL_HTTP_VERSION_1_1)
+		curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+#endif
+	oauth_curl_setopt_common(c, curl);
+	return x;
+}
+
+static void oauth_range_xfer_free(oauth_http_client *c, struct oauth_range_xfer *x) {
+	oauth_http_client_release(c, x->curl, x->url);
+	curl_slist_free_all(x->slist);
+	xfree(x->etag);
+	xfree(x->url);
+	xfree(x);
+}
+
+long long oauth_http_download_ranges(oauth_http_client *c, const oauth_ranged_download *download) {
+	oauth_ranged_download dl;
+	struct oauth_range_dl st;
+	struct oauth_chunk *chunks;
+	struct oauth_range_xfer **active;
+	CURLM *m;
+	CURLMsg *msg;
+	CURLMcode mc = CURLM_OK;
+	int i, n = 1, n_active = 0, finished = 0, failed = 0, running = 0, left;
+	char *ck;
+
+	if (!c || !download || !download->filename || !download->url) return -1;
+	dl = *download;
+	if (dl.chunk_size == 0) dl.chunk_size = OAUTH_CHUNK_DEFAULT_SIZE;
+	if (dl.parallel <= 0) dl.parallel = OAUTH_CHUNK_DEFAULT_PARALLEL;
+	if (dl.retries < 0) dl.retries = 0;
+	else if (dl.retries == 0) dl.retries = OAUTH_CHUNK_DEFAULT_RETRIES;
+
+	st.total = -1;
+	st.etag = NULL;
+	st.whole = 0;
+	st.fd = open(dl.filename, O_WRONLY | O_CREAT | O_TRUNC, 0666); // subject to the umask
+	if (st.fd < 0) return -1;
+
+	m = oauth_http_multi_acquire(c);
+	if (!m) {
+		close(st.fd);
+		return -1;
+	}
+	/* the first range doubles as probe for the size of the resource;
+	 * the other ranges are added once its reply headers arrived. */
+	chunks = (struct oauth_chunk*) xcalloc(1, sizeof(struct oauth_chunk));
+	active = (struct oauth_range_xfer**) xcalloc(dl.parallel, sizeof(struct oauth_range_xfer*));
+	ck = dl.c_key ? oauth_url_escape(dl.c_key) : NULL;
+
+	while (finished + failed < n) {
+		long long now = oauth_http_now();
+		long long wake = now + 1000;
+
+		/* start pending ranges (in order) while there are free slots */
+		for (i = 0; i < n && n_active < dl.parallel; i++) {
+			struct oauth_range_xfer *x;
+			long wait;
+			int slot;
+			if (chunks[i].state != CHUNK_PENDING) continue;
+			if (chunks[i].retry_at > now) {
+				if (chunks[i].retry_at < wake) wake = chunks[i].retry_at;
+				continue;
+			}
+			if ((wait = oauth_ratelimit_take_key(c, dl.url, ck)) > 0) {
+				if (now + wait < wake) wake = now + wait;
+				break;
+			}
+			chunks[i].attempts++;
+			x = oauth_range_xfer_new(c, &dl, &st, &chunks[i], i);
+			if (!x || curl_multi_add_handle(m, x->curl) != CURLM_OK) {
+				if (x) oauth_range_xfer_free(c, x);
+				chunks[i].state = CHUNK_FAILED;
+				failed++;
+				continue;
+			}
+			for (slot = 0; active[slot]; slot++) ;
+			active[slot] = x;
+			chunks[i].state = CHUNK_ACTIVE;
+			n_active++;
+		}
+
+		if (n_active > 0) {
+			if ((mc = curl_multi_perform(m, &running)) != CURLM_OK) break;
+		}
+
+		while ((msg = curl_multi_info_read(m, &left))) {
+			struct oauth_range_xfer *x = NULL;
+			struct oauth_chunk *ch;
+			long status = 0;
+			CURLcode res;
+			if (msg->msg != CURLMSG_DONE) continue;
+			res = msg->data.result;
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char**) &x);
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &status);
+			curl_multi_remove_handle(m, x->curl);
+			for (i = 0; i < dl.parallel; i++)
+				if (active[i] == x) active[i] = NULL;
+			n_active--;
+			wake = now; // a slot is free: no need to wait
+			oauth_ratelimit_update_key(c, x->curl, x->url, ck);
+
+			ch = &chunks[x->index];
+			if (!res && !x->error && !x->checked && st.total < 0) {
+				/* replies without a body: the resource is empty */
+				if (status == 200 || (status == 416 && x->range_total == 0)) {
+					status = 200;
+					x->checked = 1;
+				}
+			}
+			if (!x->error && !res && x->checked && (status == 200 || x->pos == x->end)) {
+				if (status == 200) st.total = x->pos;
+				ch->state = CHUNK_DONE;
+				finished++;
+			} else if (!x->error && oauth_chunk_retryable(res, status) && ch->attempts <= dl.retries) {
+				long long backoff = 500LL << (ch->attempts - 1);
+				/* resume a range where it broke off */
+				if (status == 206 && x->checked) ch->got = x->pos - (long long) x->index * dl.chunk_size;
+				ch->state = CHUNK_PENDING;
+				ch->retry_at = oauth_http_now() + (backoff > OAUTH_CHUNK_MAX_BACKOFF ? OAUTH_CHUNK_MAX_BACKOFF : backoff);
+			} else {
+				ch->state = CHUNK_FAILED;
+				failed++;
+			}
+			oauth_range_xfer_free(c, x);
+		}
+
+		/* the size is known: split the rest of the resource into ranges */
+		if (n == 1 && !failed && !st.whole && st.total > (long long) dl.chunk_size) {
+			if ((st.total - 1) / (long long) dl.chunk_size >= OAUTH_CHUNK_MAX_COUNT) {
+				failed++; // too many ranges: give up
+				break;
+			}
+			n = (int) ((st.total - 1) / (long long) dl.chunk_size + 1);
+			chunks = (struct oauth_chunk*) xrealloc(chunks, n * sizeof(struct oauth_chunk));
+			memset(&chunks[1], 0, (n - 1) * sizeof(struct oauth_chunk));
+		}
+
+		if (finished + failed >= n) break;
+		now = oauth_http_now();
+		if (n_active > 0 || wake > now) {
+			int timeout = (int) (wake > now ? wake - now : 0);
+#if LIBCURL_VERSION_NUM >= 0x074200 /* 7.66.0 */
+			mc = curl_multi_poll(m, NULL, 0, timeout, NULL);
+#else
+			if (n_active > 0) mc = curl_multi_wait(m, NULL, 0, timeout, NULL);
+			else usleep(timeout * 1000);
+#endif
+			if (mc != CURLM_OK) break;
+		}
+	}
+
+	/* ranges still running after an error */
+	for (i = 0; i < dl.parallel; i++) {
+		if (!active[i]) continue;
+		curl_multi_remove_handle(m, active[i]->curl);
+		oauth_range_xfer_free(c, active[i]);
+	}
+	if (mc != CURLM_OK) {
+		failed++;
+		curl_multi_cleanup(m);
+	} else {
+		oauth_http_multi_release(c, m);
+	}
+
+	if (close(st.fd)) failed++;
+	xfree(st.etag);
+	xfree(chunks);
+	xfree(active);
+	xfree(ck);
+	return failed ? -1 : st.total;
+}
+
+/* hedged requests */
+
+#define OAUTH_HTTP_HEDGE_MIN_SAMPLES 16
+
+static int oauth_hedge_cmp(const void *a, const void *b) {
+	long x = *(const long*)a, y = *(const long*)b;
+	return x < y ? -1 : x > y;
+}
+
+static void oauth_hedge_record(oauth_http_client *c, long ms) {
+	OAUTH_LOCK(&c->lock);
+	c->hedge_lat[c->hedge_lat_pos] = ms;
+	c->hedge_lat_pos = (c->hedge_lat_pos + 1) % OAUTH_HTTP_HEDGE_SAMPLES;
+	if (c->n_hedge_lat < OAUTH_HTTP_HEDGE_SAMPLES) c->n_hedge_lat++;
+	OAUTH_UNLOCK(&c->lock);
+}
+
+/**
+ * time to wait for a reply before sending the hedged request:
+ * the configured percentile of recently measured latencies.
+ * @return delay in ms, or -1 if hedging is disabled
+ */
+static long oauth_hedge_delay(oauth_http_client *c) {
+	long lat[OAUTH_HTTP_HEDGE_SAMPLES];
+	long percentile, delay;
+	int n;
+
+	OAUTH_LOCK(&c->lock);
+	n = c->n_hedge_lat;
+	memcpy(lat, c->hedge_lat, n * sizeof(long));
+	percentile = c->hedge_percentile;
+	delay = c->hedge_delay;
+	OAUTH_UNLOCK(&c->lock);
+
+	if (percentile == 0) return -1;
+	if (n >= OAUTH_HTTP_HEDGE_MIN_SAMPLES) {
+		int i = (int) ((n * percentile + 99) / 100) - 1;
+		qsort(lat, n, sizeof(long), oauth_hedge_cmp);
+		if (lat[i] > delay) delay = lat[i];
+	}
+	return delay;
+}
+
+static void oauth_hedge_free(oauth_http_request *req, const char *customheader) {
+	if (req->customheader != customheader) xfree((char*) req->customheader);
+	xfree((char*) req->url);
+	req->customheader = NULL;
+	req->url = NULL;
+}
+
+/**
+ * sign and start one copy of a hedged request.
+ */
+static struct oauth_http_xfer *oauth_hedge_start(oauth_http_client *c, CURLM *m, oauth_http_request *req, const char *url, const char *customheader, int auth_header, OAuthMethod method, const char *c_key, const char *c_secret, const char *t_key, const char *t_secret) {
+	struct oauth_http_xfer *x;
+	char *authheader = NULL;
+
+	memset(req, 0, sizeof(oauth_http_request));
+	req->url = oauth_http_sign_request(url, "GET", auth_header, method,
+			c_key, c_secret, t_key, t_secret, &authheader);
+	req->customheader = customheader;
+	if (authheader && customheader) {
+		char *h = (char*) xmalloc(strlen(authheader) + strlen(customheader) + 3);
+		sprintf(h, "%s\r\n%s", authheader, customheader);
+		xfree(authheader);
+		authheader = h;
+	}
+	if (authheader) req->customheader = authheader; // freed by oauth_hedge_free
+	if (!req->url || !(x = oauth_http_xfer_new(c, req))) {
+		oauth_hedge_free(req, customheader);
+		return NULL;
+	}
+	if (curl_multi_add_handle(m, x->curl) != CURLM_OK) {
+		oauth_http_xfer_done(c, x, CURLE_FAILED_INIT);
+		oauth_hedge_free(req, customheader);
+		return NULL;
+	}
+	return x;
+}
+
+char *oauth_http_client_get_hedged (oauth_http_client *c, const char *url, const char *customheader, int auth_header, OAuthMethod method, const char *c_key, const char *c_secret, const char *t_key, const char *t_secret) {
+	oauth_http_request req[2];
+	struct oauth_http_xfer *x[2] = { NULL, NULL };
+	long long started[2] = { 0, 0 };
+	long long paced = 0; //< ms, no token for the next copy before this
+	char *reply = NULL, *ck;
+	CURLM *m;
+	CURLMsg *msg;
+	CURLMcode mc = CURLM_OK;
+	long delay;
+	int i, n = 0, active = 0, winner = -1, running = 0, left;
+
+	if (!c || !url) return NULL;
+	m = oauth_http_multi_acquire(c);
+	if (!m) return NULL;
+	delay = oauth_hedge_delay(c);
+	ck = c_key ? oauth_url_escape(c_key) : NULL;
+
+	while (winner < 0) {
+		long long now = oauth_http_now();
+		int timeout = 1000;
+
+		/* send the (first or) hedged copy: every copy gets a fresh nonce
+		 * so the provider does not reject it as replay. The hedged copy
+		 * is also sent right away if the first one failed. Both copies
+		 * need a token of the rate limit. */
+		if (n < 2 && now >= paced && (n == 0 || (delay >= 0 && (active == 0 || now - started[0] >= delay)))) {
+			long wait = oauth_ratelimit_take_key(c, url, ck);
+			if (wait > 0) {
+				if (active == 0) {
+					usleep((wait > 1000 ? 1000 : wait) * 1000);
+					continue;
+				}
+				paced = now + wait;
+			} else {
+				x[n] = oauth_hedge_start(c, m, &req[n], url, customheader, auth_header, method, c_key, c_secret, t_key, t_secret);
+				started[n] = now;
+				if (x[n]) active++;
+				n++;
+			}
+		}
+		if (active == 0) break;
+
+		if ((mc = curl_multi_perform(m, &running)) != CURLM_OK) break;
+		while ((msg = curl_multi_info_read(m, &left))) {
+			struct oauth_http_xfer *done = NULL;
+			if (msg->msg != CURLMSG_DONE) continue;
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char**) &done);
+			i = (done == x[0]) ? 0 : 1;
+			if (!msg->data.result && winner < 0) winner = i;
+			curl_multi_remove_handle(m, done->curl);
+			oauth_http_xfer_done(c, done, msg->data.result);
+			x[i] = NULL;
+			active--;
+		}
+		if (winner >= 0) break;
+
+		now = oauth_http_now();
+		if (n < 2 && delay >= 0) {
+			long long due = started[0] + delay > paced ? started[0] + delay : paced;
+			if (due - now < timeout)
+				timeout = (int) (due > now ? due - now : 0);
+		}
+		if (active > 0) {
+#if LIBCURL_VERSION_NUM >= 0x074200 /* 7.66.0 */
+			mc = curl_multi_poll(m, NULL, 0, timeout, NULL);
+#else
+			mc = curl_multi_wait(m, NULL, 0, timeout, NULL);
+#endif
+			if (mc != CURLM_OK) break;
+		}
+	}
+
+	/* the latency of the first copy; if it was overtaken, the time
+	 * it had taken so far (a lower bound) */
+	if (winner >= 0)
+		oauth_hedge_record(c, (long) (oauth_http_now() - started[0]));
+
+	/* cancel the copy that lost */
+	for (i = 0; i < 2; i++) {
+		if (!x[i]) continue;
+		curl_multi_remove_handle(m, x[i]->curl);
+		oauth_http_xfer_done(c, x[i], CURLE_ABORTED_BY_CALLBACK);
+	}
+	for (i = 0; i < n; i++) {
+		if (i == winner) reply = req[i].reply;
+		else xfree(req[i].reply);
+		oauth_hedge_free(&req[i], customheader);
+	}
+	if (mc != CURLM_OK) curl_multi_cleanup(m);
+	else oauth_http_multi_release(c, m);
+	xfree(ck);
+	return reply;
+}
+
+/* non-blocking requests driven by an external event loop */
+
+struct oauth_http_loop {
+	oauth_http_client *c;
+	CURLM *multi;
+	oauth_http_socket_cb socket_cb;
+	oauth_http_timer_cb timer_cb;
+	void *arg;
+	struct oauth_http_xfer *active; //< list of transfers in progress
+	int running;
+	struct oauth_http_xfer *queued, *queued_tail; //< transfers waiting for their rate limit
+	int n_queued;
+	long long curl_due;  //< ms, when libcurl's timer expires (-1: not set)
+	long long queue_due; //< ms, when to retry the queued transfers (-1: never)
+};
+
+static int oauth_http_loop_socket(CURL *easy, curl_socket_t s, int what, void *userp, void *socketp) {
+	oauth_http_loop *l = (oauth_http_loop*) userp;
+	int events = 0;
+	if (what == CURL_POLL_REMOVE) {
+		events = OA_HTTP_POLL_REMOVE;
+	} else {
+		if (what & CURL_POLL_IN)  events |= OA_HTTP_POLL_IN;
+		if (what & CURL_POLL_OUT) events |= OA_HTTP_POLL_OUT;
+	}
+	return l->socket_cb((int) s, events, l->arg);
+}
+
+/**
+ * set the application's timer to the earlier of libcurl's timeout and
+ * the time the next queued transfer may start.
+ */
+static int oauth_http_loop_schedule(oauth_http_loop *l) {
+	long long due = l->curl_due, now;
+	if (l->queue_due >= 0 && (due < 0 || l->queue_due < due)) due = l->queue_due;
+	if (due < 0) return l->timer_cb(-1, l->arg);
+	now = oauth_http_now();
+	return l->timer_cb(due > now ? (long) (due - now) : 0, l->arg);
+}
+
+static int oauth_http_loop_timer(CURLM *multi, long timeout_ms, void *userp) {
+	oauth_http_loop *l = (oauth_http_loop*) userp;
+	l->curl_due = timeout_ms < 0 ? -1 : oauth_http_now() + timeout_ms;
+	return oauth_http_loop_schedule(l);
+}
+
+static void oauth_http_loop_unlink(oauth_http_loop *l, struct oauth_http_xfer *x) {
+	if (x->prev) x->prev->next = x->next;
+	else l->active = x->next;
+	if (x->next) x->next->prev = x->prev;
+	curl_multi_remove_handle(l->multi, x->curl);
+}
+
+/**
+ * hand completed transfers to their callbacks.
+ */
+static void oauth_http_loop_check(oauth_http_loop *l) {
+	CURLMsg *msg;
+	int left;
+	while ((msg = curl_multi_info_read(l->multi, &left))) {
+		struct oauth_http_xfer *x = NULL;
+		oauth_http_request *req;
+		oauth_http_done_cb done;
+		void *done_arg;
+		if (msg->msg != CURLMSG_DONE) continue;
+		curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char**) &x);
+		req = x->req;
+		done = x->done;
+		done_arg = x->done_arg;
+		oauth_http_loop_unlink(l, x);
+		oauth_http_xfer_done(l->c, x, msg->data.result);
+		if (done) done(req, done_arg);
+	}
+}
+
+/**
+ * hand a transfer to libcurl.
+ * @return 0 on success, -1 on error (the transfer is left alone)
+ */
+static int oauth_http_loop_run(oauth_http_loop *l, struct oauth_http_xfer *x) {
+	/* this schedules a timeout via the timer callback; the transfer
+	 * is started when the timer fires. */
+	if (curl_multi_add_handle(l->multi, x->curl) != CURLM_OK)
+		return -1;
+	x->prev = NULL;
+	x->next = l->active;
+	if (l->active) l->active->prev = x;
+	l->active = x;
+	return 0;
+}
+
+/**
+ * hold a transfer back until its rate limit allows it.
+ * @param wait ms until then
+ */
+static void oauth_http_loop_enqueue(oauth_http_loop *l, struct oauth_http_xfer *x, long wait) {
+	long long due = oauth_http_now() + wait;
+	x->next = NULL;
+	if (l->queued_tail) l->queued_tail->next = x;
+	else l->queued = x;
+	l->queued_tail = x;
+	l->n_queued++;
+	if (l->queue_due < 0 || due < l->queue_due) l->queue_due = due;
+}
+
+/**
+ * start the queued transfers whose rate limit allows it and
+ * queue the others again.
+ */
+static void oauth_http_loop_dequeue(oauth_http_loop *l) {
+	struct oauth_http_xfer *x, *list = l->queued;
+
+	/* detached, since the callbacks may add requests */
+	l->queued = l->queued_tail = NULL;
+	l->queue_due = -1;
+	while ((x = list)) {
+		oauth_http_request *req = x->req;
+		long wait;
+		list = x->next;
+		l->n_queued--;
+		if ((wait = oauth_ratelimit_take(l->c, req->url, req->customheader)) > 0) {
+			oauth_http_loop_enqueue(l, x, wait);
+		} else if (oauth_http_loop_run(l, x)) {
+			oauth_http_done_cb done = x->done;
+			void *done_arg = x->done_arg;
+			oauth_http_xfer_done(l->c, x, CURLE_FAILED_INIT);
+			if (done) done(req, done_arg);
+		}
+	}
+}
+
+oauth_http_loop *oauth_http_loop_new(oauth_http_client *c, oauth_http_socket_cb socket_cb, oauth_http_timer_cb timer_cb, void *arg) {
+	oauth_http_loop *l;
+	if (!c || !socket_cb || !timer_cb) return NULL;
+	l = (oauth_http_loop*) xcalloc(1, sizeof(oauth_http_loop));
+	l->multi = curl_multi_init();
+	if (!l->multi) {
+		xfree(l);
+		return NULL;
+	}
+	l->c = c;
+	l->socket_cb = socket_cb;
+	l->timer_cb = timer_cb;
+	l->arg = arg;
+	l->curl_due = -1;
+	l->queue_due = -1;
+	curl_multi_setopt(l->multi, CURLMOPT_SOCKETFUNCTION, oauth_http_loop_socket);
+	curl_multi_setopt(l->multi, CURLMOPT_SOCKETDATA, (void*) l);
+	curl_multi_setopt(l->multi, CURLMOPT_TIMERFUNCTION, oauth_http_loop_timer);
+	curl_multi_setopt(l->multi, CURLMOPT_TIMERDATA, (void*) l);
+	curl_multi_setopt(l->multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, c->max_parallel);
+	oauth_curl_multi_setopt_common(c, l->multi);
+	return l;
+}
+
+void oauth_http_loop_free(oauth_http_loop *l) {
+	if (!l) return;
+	while (l->active) {
+		struct oauth_http_xfer *x = l->active;
+		oauth_http_request *req = x->req;
+		oauth_http_done_cb done = x->done;
+		void *done_arg = x->done_arg;
+		oauth_http_loop_unlink(l, x);
+		oauth_http_xfer_done(l->c, x, CURLE_ABORTED_BY_CALLBACK);
+		if (done) done(req, done_arg);
+	}
+	while (l->queued) {
+		struct oauth_http_xfer *x = l->queued;
+		oauth_http_request *req = x->req;
+		oauth_http_done_cb done = x->done;
+		void *done_arg = x->done_arg;
+		l->queued = x->next;
+		oauth_http_xfer_done(l->c, x, CURLE_ABORTED_BY_CALLBACK);
+		if (done) done(req, done_arg);
+	}
+	curl_multi_cleanup(l->multi);
+	xfree(l);
+}
+
+int oauth_http_loop_add(oauth_http_loop *l, oauth_http_request *req, oauth_http_done_cb done, void *done_arg) {
+	struct oauth_http_xfer *x;
+	long wait;
+	req->reply = NULL;
+	req->reply_len = 0;
+	req->status = 0;
+	req->error = 0;
+	x = oauth_http_xfer_new(l->c, req);
+	if (!x) return -1;
+	x->done = done;
+	x->done_arg = done_arg;
+	if ((wait = oauth_ratelimit_take(l->c, req->url, req->customheader)) > 0) {
+		/* wait for a token; requests to other hosts go ahead */
+		oauth_http_loop_enqueue(l, x, wait);
+		oauth_http_loop_schedule(l);
+		return 0;
+	}
+	if (oauth_http_loop_run(l, x)) {
+		oauth_http_xfer_done(l->c, x, CURLE_FAILED_INIT);
+		return -1;
+	}
+	return 0;
+}
+
+static int oauth_http_loop_action(oauth_http_loop *l, curl_socket_t s, int mask) {
+	if (curl_multi_socket_action(l->multi, s, mask, &l->running) != CURLM_OK)
+		return -1;
+	oauth_http_loop_check(l);
+	if (l->queued) {
+		oauth_http_loop_dequeue(l);
+		oauth_http_loop_schedule(l);
+	}
+	return l->running + l->n_queued;
+}
+
+int oauth_http_loop_socket_action(oauth_http_loop *l, int fd, int events) {
+	int mask = 0;
+	if (events & OA_HTTP_POLL_IN)  mask |= CURL_CSELECT_IN;
+	if (events & OA_HTTP_POLL_OUT) mask |= CURL_CSELECT_OUT;
+	if (events & OA_HTTP_POLL_ERR) mask |= CURL_CSELECT_ERR;
+	return oauth_http_loop_action(l, (curl_socket_t) fd, mask);
+}
+
+int oauth_http_loop_timeout(oauth_http_loop *l) {
+	/* libcurl sets its timer again if it needs one */
+	if (l->curl_due >= 0 && l->curl_due <= oauth_http_now()) l->curl_due = -1;
+	return oauth_http_loop_action(l, CURL_SOCKET_TIMEOUT, 0);
+}
+
+/* the traditional oauth_curl_* API uses the default client */
 
-	chunk.data=NULL;
-	chunk.size=0;
+char *oauth_curl_post (const char *u, const char *p, const char *customheader) {
+	return oauth_http_client_post(oauth_http_client_default(), u, p, customheader);
+}
 
-	if (customheader)
-		slist = curl_slist_append(slist, customheader);
-	else
-		slist = curl_slist_append(slist, "Content-Type: image/jpeg;"); // good guess :)
+char *oauth_curl_get (const char *u, const char *q, const char *customheader) {
+	return oauth_http_client_get(oauth_http_client_default(), u, q, customheader);
+}
 
-	f = fopen(fn,"r");
-	if (!f) return NULL;
+char *oauth_curl_post_file (const char *u, const char *fn, size_t len, const char *customheader) {
+	return oauth_http_client_post_file(oauth_http_client_default(), u, fn, len, customheader);
+}
 
-	fseek(f, 0L, SEEK_END);
-	filelen = ftell(f);
-	fseek(f, 0L, SEEK_SET);
+int oauth_http_stream (const char *u, const char *httpMethod, const char *body, size_t len, const char *customheader, oauth_http_sink *sink) {
+	return oauth_http_client_stream(oauth_http_client_default(), u, httpMethod, body, len, customheader, sink);
+}
 
-	if (!len || len > filelen) {
-		len = filelen;
-	}
+static char *oauth_curl_send_file_with_callback (const char *u, const char *fn, const char *customheader, void (*callback)(void*,int,size_t,size_t), void *callback_data, const char *httpMethod) {
+	return oauth_http_client_send_file(oauth_http_client_default(), u, fn, customheader, callback, callback_data, httpMethod);
+}
 
-	curl = curl_easy_init();
-	if(!curl) {
-		fclose(f);
-		return NULL;
-	}
-	curl_easy_setopt(curl, CURLOPT_URL, u);
-	curl_easy_setopt(curl, CURLOPT_POST, 1);
-	curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, len);
-	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, slist);
-	curl_easy_setopt(curl, CURLOPT_READDATA, f);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
-	curl_easy_setopt(curl, CURLOPT_USERAGENT, OAUTH_USER_AGENT);
-#ifdef OAUTH_CURL_TIMEOUT
-	curl_easy_setopt(curl, CURLOPT_TIMEOUT, OAUTH_CURL_TIMEOUT);
-	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
-#endif
-	GLOBAL_CURL_ENVIROMENT_OPTIONS;
-	res = curl_easy_perform(curl);
-	curl_slist_free_all(slist);
-	fclose(f);
-	if (res) {
-		// error
-		return NULL;
-	}
+static char *oauth_curl_send_multipart (const char *u, oauth_multipart *mp, const char *customheader, void (*callback)(void*,int,size_t,size_t), void *callback_data, const char *httpMethod) {
+	return oauth_http_client_send_multipart(oauth_http_client_default(), u, mp, customheader, callback, callback_data, httpMethod);
+}
 
-	curl_easy_cleanup(curl);
-	return (chunk.data);
+static char *oauth_curl_send_iov_with_callback (const char *u, const struct iovec *iov, int iovcnt, const char *customheader, void (*callback)(void*,int,size_t,size_t), void *callback_data, const char *httpMethod) {
+	return oauth_http_client_send_iov(oauth_http_client_default(), u, iov, iovcnt, customheader, callback, callback_data, httpMethod);
 }
 
 /**
@@ -297,60 +3660,10 @@ char *oauth_curl_post_file (const char *u, const char *fn, size_t len, const cha
  * @return returned HTTP reply or NULL on error
  */
 char *oauth_curl_send_data_with_callback (const char *u, const char *data, size_t len, const char *customheader, void (*callback)(void*,int,size_t,size_t), void *callback_data, const char *httpMethod) {
-	CURL *curl;
-	CURLcode res;
-	struct curl_slist *slist=NULL;
-	struct MemoryStruct chunk;
-	struct MemoryStruct rdnfo;
-
-	chunk.data=NULL;
-	chunk.size=0;
-	chunk.start_size=0;
-	chunk.callback=callback;
-	chunk.callback_data=callback_data;
-	rdnfo.data=(char *)data;
-	rdnfo.size=len;
-	rdnfo.start_size=len;
-	rdnfo.callback=callback;
-	rdnfo.callback_data=callback_data;
-
-	if (customheader)
-		slist = curl_slist_append(slist, customheader);
-	else
-		slist = curl_slist_append(slist, "Content-Type: image/jpeg;");
-
-	curl = curl_easy_init();
-	if(!curl) return NULL;
-	curl_easy_setopt(curl, CURLOPT_URL, u);
-	curl_easy_setopt(curl, CURLOPT_POST, 1);
-	if (httpMethod) curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, httpMethod);
-	curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, len);
-	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, slist);
-	curl_easy_setopt(curl, CURLOPT_READDATA, (void *)&rdnfo);
-	if (callback)
-		curl_easy_setopt(curl, CURLOPT_READFUNCTION, ReadMemoryCallbackAndCall);
-	else
-		curl_easy_setopt(curl, CURLOPT_READFUNCTION, ReadMemoryCallback);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
-	if (callback)
-		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallbackAndCall);
-	else
-		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
-	curl_easy_setopt(curl, CURLOPT_USERAGENT, OAUTH_USER_AGENT);
-#ifdef OAUTH_CURL_TIMEOUT
-	curl_easy_setopt(curl, CURLOPT_TIMEOUT, OAUTH_CURL_TIMEOUT);
-	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
-#endif
-	GLOBAL_CURL_ENVIROMENT_OPTIONS;
-	res = curl_easy_perform(curl);
-	curl_slist_free_all(slist);
-	if (res) {
-		// error
-		return NULL;
-	}
-
-	curl_easy_cleanup(curl);
-	return (chunk.data);
+	struct iovec iov;
+	iov.iov_base = (void*) data;
+	iov.iov_len = len;
+	return oauth_curl_send_iov_with_callback(u, &iov, 1, customheader, callback, callback_data, httpMethod);
 }
 
 /**
@@ -377,6 +3690,38 @@ char *oauth_curl_post_data_with_callback (const char *u, const char *data, size_
 	return oauth_curl_send_data_with_callback(u, data, len, customheader, callback, callback_data, NULL);
 }
 
+#else // no libcURL.
+
+oauth_http_client *oauth_http_client_new(int max_idle) { return NULL; }
+void oauth_http_client_free(oauth_http_client *c) { }
+oauth_http_client *oauth_http_client_default(void) { return NULL; }
+void oauth_http_global_cleanup(void) {
+#ifdef HAVE_NATIVE_HTTP
+	nhttp_cleanup();
+#endif
+}
+char *oauth_http_client_get (oauth_http_client *c, const char *u, const char *q, const char *customheader) { return NULL; }
+char *oauth_http_client_post (oauth_http_client *c, const char *u, const char *p, const char *customheader) { return NULL; }
+char *oauth_http_client_post_file (oauth_http_client *c, const char *u, const char *fn, size_t len, const char *customheader) { return NULL; }
+char *oauth_http_client_send_file (oauth_http_client *c, const char *u, const char *fn, const char *customheader, void (*callback)(void*,int,size_t,size_t), void *callback_data, const char *httpMethod) { return NULL; }
+char *oauth_http_client_send_iov (oauth_http_client *c, const char *u, const struct iovec *iov, int iovcnt, const char *customheader, void (*callback)(void*,int,size_t,size_t), void *callback_data, const char *httpMethod) { return NULL; }
+char *oauth_http_client_send_multipart (oauth_http_client *c, const char *u, oauth_multipart *mp, const char *customheader, void (*callback)(void*,int,size_t,size_t), void *callback_data, const char *httpMethod) { return NULL; }
+int oauth_http_session_cache(const char *filename) { return -1; }
+int oauth_http_session_cache_flush(void) { return -1; }
+int oauth_http_client_setopt(oauth_http_client *c, OAuthHttpOption opt, long value) { return -1; }
+void oauth_http_client_recycle(oauth_http_client *c, char *reply) { xfree(reply); }
+int oauth_http_client_stream (oauth_http_client *c, const char *u, const char *httpMethod, const char *body, size_t len, const char *customheader, oauth_http_sink *sink) { return -1; }
+int oauth_http_stream (const char *u, const char *httpMethod, const char *body, size_t len, const char *customheader, oauth_http_sink *sink) { return -1; }
+int oauth_http_upload_chunks(oauth_http_client *c, const oauth_chunked_upload *upload) { return -1; }
+long long oauth_http_download_ranges(oauth_http_client *c, const oauth_ranged_download *download) { return -1; }
+char *oauth_http_client_get_hedged (oauth_http_client *c, const char *url, const char *customheader, int auth_header, OAuthMethod method, const char *c_key, const char *c_secret, const char *t_key, const char *t_secret) { return NULL; }
+int oauth_http_client_cache_dir(oauth_http_client *c, const char *dir) { return -1; }
+oauth_http_loop *oauth_http_loop_new(oauth_http_client *c, oauth_http_socket_cb socket_cb, oauth_http_timer_cb timer_cb, void *arg) { return NULL; }
+void oauth_http_loop_free(oauth_http_loop *l) { }
+int oauth_http_loop_add(oauth_http_loop *l, oauth_http_request *req, oauth_http_done_cb done, void *done_arg) { return -1; }
+int oauth_http_loop_socket_action(oauth_http_loop *l, int fd, int events) { return -1; }
+int oauth_http_loop_timeout(oauth_http_loop *l) { return -1; }
+
 #endif // libcURL.
 
 
@@ -416,6 +3761,17 @@ char *oauth_curl_post_data_with_callback (const char *u, const char *data, size_
 #endif
 
 #include <stdio.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#ifdef HAVE_SPAWN_H
+#include <spawn.h>
+#endif
+
+extern char **environ;
+
+#ifndef MSG_NOSIGNAL
+# define MSG_NOSIGNAL 0
+#endif
 
 /**
  *  escape URL for use in String Quotes (aka shell single quotes).
@@ -442,22 +3798,228 @@ char *oauth_curl_post_data_with_callback (const char *u, const char *data, size_
  * @return escaped parameter
  */
 char *oauth_escape_shell (const char *cmd) {
-	char *esc = xstrdup(cmd);
-	char *tmp = esc;
-	int idx;
-	while ((tmp=strchr(tmp,'\''))) {
-		idx = tmp-esc;
-		esc=(char*)xrealloc(esc,(strlen(esc)+5)*sizeof(char));
-		memmove(esc+idx+4,esc+idx+1, strlen(esc+idx));
-		esc[idx+1]='\\'; esc[idx+2]='\''; esc[idx+3]='\'';
-		tmp=esc+(idx+4);
+	size_t ticks = 0;
+	const char *s;
+	char *esc, *d;
+	for (s = cmd; *s; s++) if (*s == '\'') ticks++;
+	esc = d = (char*) xmalloc((strlen(cmd) + 3 * ticks + 1) * sizeof(char));
+	for (s = cmd; *s; s++) {
+		*d++ = *s;
+		if (*s == '\'') { *d++='\\'; *d++='\''; *d++='\''; }
 	}
+	*d = 0;
 
 	// TODO escape '!' if CSHELL ?!
 
 	return esc;
 }
 
+/* buffer for collecting child output and argv words; grows geometrically */
+struct ExecBuf {
+	char *data;
+	size_t len;
+	size_t alloc;
+};
+
+static void oauth_execbuf_reserve(struct ExecBuf *b, size_t n) {
+	if (b->len + n + 1 <= b->alloc) return;
+	if (b->alloc < 1024) b->alloc = 1024;
+	while (b->len + n + 1 > b->alloc) b->alloc *= 2;
+	b->data = (char*) xrealloc(b->data, b->alloc);
+}
+
+static void oauth_execbuf_append(struct ExecBuf *b, const char *s, size_t n) {
+	oauth_execbuf_reserve(b, n);
+	memcpy(b->data + b->len, s, n);
+	b->len += n;
+	b->data[b->len] = 0;
+}
+
+/**
+ * read everything from fd until EOF.
+ * @param len if not NULL, the number of bytes read is stored here
+ * @return NUL-terminated data (possibly empty) that needs to be freed.
+ */
+static char *oauth_exec_slurp(int fd, size_t *len) {
+	struct ExecBuf b = {NULL, 0, 0};
+	ssize_t rcv;
+	oauth_execbuf_reserve(&b, 0);
+	for (;;) {
+		oauth_execbuf_reserve(&b, BUFSIZ);
+		rcv = read(fd, b.data + b.len, b.alloc - b.len - 1);
+		if (rcv < 0 && errno == EINTR) continue;
+		if (rcv <= 0) break;
+		b.len += rcv;
+	}
+	b.data[b.len] = 0;
+#ifdef DEBUG_OAUTH
+	printf("DEBUG: read %lu bytes\n", (unsigned long) b.len);
+#endif
+	if (len) *len = b.len;
+	return b.data;
+}
+
+/**
+ * split a command template into an argv array, the way a POSIX shell
+ * would for a simple command: words are separated by blanks, and
+ * single-quotes, double-quotes and backslashes quote characters.
+ * the placeholders '%u' and '%p' are replaced verbatim by u and p
+ * (in any quoting context) and need no escaping; '%%' yields '%'.
+ *
+ * @return NULL-terminated argv (free with oauth_exec_argv_free) or NULL
+ * if the template uses shell features (pipes, redirection, variables,..)
+ * or is malformed, in which case it has to be run via /bin/sh.
+ */
+static char **oauth_exec_argv(const char *tpl, const char *u, const char *p) {
+	char **argv = NULL;
+	int argc = 0;
+	struct ExecBuf w = {NULL, 0, 0};
+	int inword = 0;
+	char quote = 0;
+	const char *s = tpl;
+
+	for (;; s++) {
+		if (!*s || (!quote && (*s == ' ' || *s == '\t' || *s == '\n'))) {
+			if (quote) goto looser;
+			if (inword) {
+				argv = (char**) xrealloc(argv, (argc + 2) * sizeof(char*));
+				argv[argc++] = w.data ? w.data : xstrdup("");
+				argv[argc] = NULL;
+				w.data = NULL; w.len = w.alloc = 0;
+				inword = 0;
+			}
+			if (!*s) break;
+			continue;
+		}
+		if (!quote && !inword && (*s == '#' || *s == '~')) goto looser;
+		inword = 1;
+		if (*s == '%' && (s[1] == 'u' || s[1] == 'p' || s[1] == '%')) {
+			const char *v = s[1] == 'u' ? u : s[1] == 'p' ? p : "%";
+			if (!v) v = "";
+			oauth_execbuf_append(&w, v, strlen(v));
+			s++;
+		} else if (quote == '\'') {
+			if (*s == '\'') quote = 0;
+			else oauth_execbuf_append(&w, s, 1);
+		} else if (*s == '\\') {
+			if (!s[1]) goto looser;
+			if (quote == '"' && !strchr("\"\\$`\n", s[1]))
+				oauth_execbuf_append(&w, s, 1);
+			s++;
+			if (*s != '\n') oauth_execbuf_append(&w, s, 1);
+		} else if (quote == '"') {
+			if (*s == '"') quote = 0;
+			else if (*s == '$' || *s == '`') goto looser;
+			else oauth_execbuf_append(&w, s, 1);
+		} else if (*s == '\'' || *s == '"') {
+			quote = *s;
+		} else if (strchr("|&;<>()$`*?[", *s)) {
+			goto looser;
+		} else {
+			oauth_execbuf_append(&w, s, 1);
+		}
+	}
+	if (argc > 0) return argv;
+
+looser:
+	xfree(w.data);
+	while (argc > 0) xfree(argv[--argc]);
+	xfree(argv);
+	return NULL;
+}
+
+static void oauth_exec_argv_free(char **argv) {
+	char **a;
+	for (a = argv; *a; a++) xfree(*a);
+	xfree(argv);
+}
+
+/**
+ * execute a command directly - without a shell - and return its output.
+ * the program is looked up in PATH, its stdout is connected to a pipe.
+ *
+ * posix_spawn() is used where available; it does not have to copy the
+ * page tables of the calling process, which matters when the
+ * application is large.
+ *
+ * If input is given, it is connected to the command's stdin and written
+ * completely before the output is read; this is only suitable for
+ * programs that consume all input before they produce output (e.g.
+ * 'curl -K -').
+ *
+ * @param argv NULL-terminated argument vector
+ * @param in data for stdin or NULL to inherit stdin
+ * @param inlen length of in
+ * @param outlen if not NULL, the length of the output is stored here
+ * @return stdout string that needs to be freed or NULL if the command
+ * could not be started.
+ */
+static char *oauth_exec_spawn (char *const argv[], const char *in, size_t inlen, size_t *outlen) {
+	int fd[2];
+	int sv[2] = {-1, -1};
+	pid_t pid;
+	int status;
+	char *data;
+#ifdef DEBUG_OAUTH
+	printf("DEBUG: spawning: %s\n",argv[0]);
+#endif
+	if (pipe(fd)) return NULL;
+	fcntl(fd[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fd[1], F_SETFD, FD_CLOEXEC);
+	// a socket (rather than a pipe) allows to write without SIGPIPE
+	if (in && socketpair(AF_UNIX, SOCK_STREAM, 0, sv)) {
+		close(fd[0]); close(fd[1]);
+		return NULL;
+	}
+	if (in) {
+		fcntl(sv[0], F_SETFD, FD_CLOEXEC);
+		fcntl(sv[1], F_SETFD, FD_CLOEXEC);
+	}
+#if defined HAVE_SPAWN_H && defined HAVE_POSIX_SPAWNP
+	{
+		posix_spawn_file_actions_t fa;
+		int rv;
+		posix_spawn_file_actions_init(&fa);
+		posix_spawn_file_actions_adddup2(&fa, fd[1], STDOUT_FILENO);
+		if (in) posix_spawn_file_actions_adddup2(&fa, sv[1], STDIN_FILENO);
+		rv = posix_spawnp(&pid, argv[0], &fa, NULL, argv, environ);
+		posix_spawn_file_actions_destroy(&fa);
+		if (rv) pid = -1;
+	}
+#else
+	pid = vfork();
+	if (pid == 0) {
+		dup2(fd[1], STDOUT_FILENO);
+		if (in) dup2(sv[1], STDIN_FILENO);
+		execvp(argv[0], argv);
+		_exit(127);
+	}
+#endif
+	close(fd[1]);
+	if (in) close(sv[1]);
+	if (pid < 0) {
+		close(fd[0]);
+		if (in) close(sv[0]);
+		return NULL;
+	}
+	if (in) {
+		while (inlen > 0) {
+			ssize_t w = send(sv[0], in, inlen, MSG_NOSIGNAL);
+			if (w < 0 && errno == EINTR) continue;
+			if (w <= 0) break;
+			in += w; inlen -= w;
+		}
+		close(sv[0]);
+	}
+	data = oauth_exec_slurp(fd[0], outlen);
+	close(fd[0]);
+	while (waitpid(pid, &status, 0) < 0 && errno == EINTR) ;
+#ifdef DEBUG_OAUTH
+	printf("DEBUG: return: %s\n",data);
+#endif
+	return data;
+}
+
 /**
  * execute command via shell and return it's output.
  * This is used to call 'curl' or 'wget'.
@@ -471,28 +4033,48 @@ char *oauth_exec_shell (const char *cmd) {
 	printf("DEBUG: executing: %s\n",cmd);
 #endif
 	FILE *in = popen (cmd, "r");
-	size_t len = 0;
-	size_t alloc = 0;
-	char *data = NULL;
-	int rcv = 1;
-	while (in && rcv > 0 && !feof(in)) {
-		alloc +=1024;
-		data = (char*)xrealloc(data, alloc * sizeof(char));
-		rcv = fread(data + (alloc-1024), sizeof(char), 1024, in);
-		len += rcv;
-	}
+	char *data;
+	if (!in) return NULL;
+	data = oauth_exec_slurp(fileno(in), NULL);
 	pclose(in);
-#ifdef DEBUG_OAUTH
-	printf("DEBUG: read %i bytes\n",len);
-#endif
-	data[len]=0;
-#ifdef DEBUG_OAUTH
-	if (data) printf("DEBUG: return: %s\n",data);
-	else printf("DEBUG: NULL data\n");
-#endif
 	return (data);
 }
 
+/**
+ * run a command template: directly via posix_spawn if it is a
+ * simple command, otherwise through the shell with escaped arguments.
+ */
+static char *oauth_exec_template (const char *cmdtpl, const char *u, const char *p) {
+	char **argv = oauth_exec_argv(cmdtpl, u, p);
+	char *rv;
+	struct ExecBuf cmd = {NULL, 0, 0};
+	const char *s;
+
+	if (argv) {
+		rv = oauth_exec_spawn(argv, NULL, 0, NULL);
+		oauth_exec_argv_free(argv);
+		return rv;
+	}
+
+	for (s = cmdtpl; *s; s++) {
+		if (*s == '%' && (s[1] == 'u' || s[1] == 'p')) {
+			const char *v = s[1] == 'u' ? u : p;
+			char *e = oauth_escape_shell(v ? v : "");
+			oauth_execbuf_append(&cmd, e, strlen(e));
+			xfree(e);
+			s++;
+		} else if (*s == '%' && s[1] == '%') {
+			oauth_execbuf_append(&cmd, s, 1);
+			s++;
+		} else {
+			oauth_execbuf_append(&cmd, s, 1);
+		}
+	}
+	rv = oauth_exec_shell(cmd.data);
+	xfree(cmd.data);
+	return rv;
+}
+
 /**
  * send POST via a command line HTTP client,  wait for it to finish
  * and return the content of the reply. requires a command-line HTTP client
@@ -505,32 +4087,15 @@ char *oauth_exec_shell (const char *cmd) {
  * replied content from HTTP server. latter needs to be freed by caller.
  */
 char *oauth_exec_post (const char *u, const char *p) {
-	char cmd[BUFSIZ];
-	char *t1,*t2;
-	char *cmdtpl = getenv(_OAUTH_ENV_HTTPCMD);
-	if (!cmdtpl) cmdtpl = xstrdup (_OAUTH_DEF_HTTPCMD);
-	else cmdtpl = xstrdup (cmdtpl); // clone getenv() string.
-
-	// add URL and post param - error if no '%p' or '%u' present in definition
-	t1=strstr(cmdtpl, "%p");
-	t2=strstr(cmdtpl, "%u");
-	if (!t1 || !t2) {
+	const char *cmdtpl = getenv(_OAUTH_ENV_HTTPCMD);
+	if (!cmdtpl) cmdtpl = _OAUTH_DEF_HTTPCMD;
+
+	// error if no '%p' or '%u' present in definition
+	if (!strstr(cmdtpl, "%p") || !strstr(cmdtpl, "%u")) {
 		fprintf(stderr, "\nliboauth: invalid HTTP command. set the '%s' environment variable.\n\n",_OAUTH_ENV_HTTPCMD);
 		return(NULL);
 	}
-	// TODO: check if there are exactly two '%' in cmdtpl
-	*(++t1)= 's'; *(++t2)= 's';
-	if (t1>t2) {
-		t1=oauth_escape_shell(u);
-		t2=oauth_escape_shell(p);
-	} else {
-		t1=oauth_escape_shell(p);
-		t2=oauth_escape_shell(u);
-	}
-	snprintf(cmd, BUFSIZ, cmdtpl, t1, t2);
-	xfree(cmdtpl);
-	xfree(t1); xfree(t2);
-	return oauth_exec_shell(cmd);
+	return oauth_exec_template(cmdtpl, u, p);
 }
 
 /**
@@ -548,40 +4113,236 @@ char *oauth_exec_post (const char *u, const char *p) {
  * replied content from HTTP server. latter needs to be freed by caller.
  */
 char *oauth_exec_get (const char *u, const char *q) {
-	char cmd[BUFSIZ];
-	char *cmdtpl, *t1, *e1;
+	const char *cmdtpl;
+	char *t1 = NULL, *rv;
 
 	if (!u) return (NULL);
 
 	cmdtpl = getenv(_OAUTH_ENV_HTTPGET);
-	if (!cmdtpl) cmdtpl = xstrdup (_OAUTH_DEF_HTTPGET);
-	else cmdtpl = xstrdup (cmdtpl); // clone getenv() string.
+	if (!cmdtpl) cmdtpl = _OAUTH_DEF_HTTPGET;
 
-	// add URL and post param - error if no '%p' or '%u' present in definition
-	t1=strstr(cmdtpl, "%u");
-	if (!t1) {
+	// error if no '%u' present in definition
+	if (!strstr(cmdtpl, "%u")) {
 		fprintf(stderr, "\nliboauth: invalid HTTP command. set the '%s' environment variable.\n\n",_OAUTH_ENV_HTTPGET);
-		xfree(cmdtpl);
 		return(NULL);
 	}
-	*(++t1)= 's';
 
-	e1 = oauth_escape_shell(u);
 	if (q) {
-		char *e2;
-		e2 = oauth_escape_shell(q);
-		t1=(char*)xmalloc(sizeof(char)*(strlen(e1)+strlen(e2)+2));
-		strcpy(t1,e1); strcat(t1,"?"); strcat(t1,e2);
-		xfree(e2);
-	}
-	snprintf(cmd, BUFSIZ, cmdtpl, q?t1:e1);
-	xfree(cmdtpl);
-	xfree(e1);
-	if (q) xfree(t1);
-	return oauth_exec_shell(cmd);
+		t1=(char*)xmalloc(sizeof(char)*(strlen(u)+strlen(q)+2));
+		strcpy(t1,u); strcat(t1,"?"); strcat(t1,q);
+	}
+	rv = oauth_exec_template(cmdtpl, q?t1:u, NULL);
+	xfree(t1);
+	return rv;
+}
+#ifndef HAVE_CURL
+/**
+ * append s as a quoted string for a curl config file
+ */
+static void oauth_exec_cfgstr(struct ExecBuf *b, const char *s, size_t len) {
+	size_t i;
+	oauth_execbuf_append(b, "\"", 1);
+	for (i = 0; i < len; i++) {
+		switch (s[i]) {
+			case '\\': oauth_execbuf_append(b, "\\\\", 2); break;
+			case '"':  oauth_execbuf_append(b, "\\\"", 2); break;
+			case '\n': oauth_execbuf_append(b, "\\n", 2); break;
+			case '\r': oauth_execbuf_append(b, "\\r", 2); break;
+			case '\t': oauth_execbuf_append(b, "\\t", 2); break;
+			default:   oauth_execbuf_append(b, s + i, 1); break;
+		}
+	}
+	oauth_execbuf_append(b, "\"\n", 2);
+}
+
+static void oauth_exec_cfgopt(struct ExecBuf *b, const char *opt, const char *val, size_t len) {
+	oauth_execbuf_append(b, opt, strlen(opt));
+	oauth_execbuf_append(b, " = ", 3);
+	oauth_exec_cfgstr(b, val, len);
+}
+
+/**
+ * find s in [p,end); unlike strstr() this works with NUL bytes in the data.
+ */
+static char *oauth_exec_memfind(char *p, char *end, const char *s, size_t sl) {
+	for (p = memchr(p, *s, end - p); p && p + sl <= end; p = memchr(p + 1, *s, end - p - 1))
+		if (!memcmp(p, s, sl)) return p;
+	return NULL;
+}
+
+/**
+ * perform a batch of requests with a single curl process.
+ *
+ * All requests are written to curl's stdin as a config file, separated
+ * by 'next'; curl performs them one after the other and keeps
+ * connections open in between. After each reply curl writes a marker
+ * line with the HTTP status and curl exit code (-w), which is used to
+ * split the output into the individual replies.
+ *
+ * Request bodies must not contain NUL bytes.
+ */
+static void oauth_exec_batch(oauth_http_request **reqs, int n, oauth_http_done_cb done, void *arg) {
+	static unsigned int seq = 0;
+	char *const argv[] = { "curl", "-K", "-", NULL };
+	struct ExecBuf cfg = {NULL, 0, 0};
+	char marker[64], wout[96];
+	char *out, *pos, *end, *nonce;
+	size_t outlen = 0, mlen;
+	int i, nb = 0;
+
+	/* the marker must not be predictable: a reply containing it
+	 * would shift the replies of all following requests */
+	nonce = oauth_gen_nonce();
+	snprintf(marker, sizeof(marker), "--liboauth-%s-%x--", nonce, ++seq);
+	xfree(nonce);
+	snprintf(wout, sizeof(wout), "%s %%{http_code} %%{exitcode}\n", marker);
+	mlen = strlen(marker);
+
+	for (i = 0; i < n; i++) {
+		oauth_http_request *req = reqs[i];
+		const char *h;
+		if (req->body && memchr(req->body, 0, req->body_len)) {
+			req->error = 43; // CURLE_BAD_FUNCTION_ARGUMENT
+			continue;
+		}
+		if (nb++ > 0) oauth_execbuf_append(&cfg, "next\n", 5);
+		oauth_execbuf_append(&cfg, "silent\n", 7);
+		oauth_exec_cfgopt(&cfg, "url", req->url, strlen(req->url));
+		oauth_exec_cfgopt(&cfg, "user-agent", OAUTH_USER_AGENT, strlen(OAUTH_USER_AGENT));
+#ifdef OAUTH_CURL_TIMEOUT
+		oauth_execbuf_append(&cfg, "max-time = " cpxstr(OAUTH_CURL_TIMEOUT) "\n", strlen("max-time = " cpxstr(OAUTH_CURL_TIMEOUT) "\n"));
+#endif
+		if (req->method && !strcmp(req->method, "HEAD"))
+			oauth_execbuf_append(&cfg, "head\n", 5);
+		else if (req->method)
+			oauth_exec_cfgopt(&cfg, "request", req->method, strlen(req->method));
+		if (req->body)
+			oauth_exec_cfgopt(&cfg, "data-binary", req->body, req->body_len);
+		for (h = req->customheader; h && *h; ) {
+			size_t hl = strcspn(h, "\r\n");
+			if (hl > 0) oauth_exec_cfgopt(&cfg, "header", h, hl);
+			h += hl;
+			h += strspn(h, "\r\n");
+		}
+		oauth_exec_cfgopt(&cfg, "write-out", wout, strlen(wout));
+	}
+
+	out = nb ? oauth_exec_spawn(argv, cfg.data, cfg.len, &outlen) : NULL;
+	xfree(cfg.data);
+
+	pos = out;
+	end = out + outlen;
+	for (i = 0; i < n; i++) {
+		oauth_http_request *req = reqs[i];
+		char *m = NULL;
+		long status = 0;
+		int exitcode = -1;
+		if (req->error) goto complete;
+		if (pos) m = oauth_exec_memfind(pos, end, marker, mlen);
+		if (!m) {
+			req->error = 2; // CURLE_FAILED_INIT
+			pos = NULL;
+			goto complete;
+		}
+		sscanf(m + mlen, " %ld %d", &status, &exitcode);
+		req->status = status;
+		req->error = exitcode >= 0 ? exitcode : (status > 0 ? 0 : 2);
+		if (!req->error) {
+			req->reply_len = m - pos;
+			req->reply = (char*) xmalloc(req->reply_len + 1);
+			memcpy(req->reply, pos, req->reply_len);
+			req->reply[req->reply_len] = 0;
+		}
+		pos = memchr(m, '\n', end - m);
+		if (pos) pos++;
+complete:
+		if (done) done(req, arg);
+	}
+	xfree(out);
 }
+#endif
 #endif // command-line curl.
 
+#ifdef HAVE_NATIVE_HTTP /* HTTP requests via the built-in client */
+
+/**
+ * use the built-in HTTP client unless it can not handle the URL
+ * (https without TLS support) or a command for the shell
+ * transport was explicitly configured.
+ */
+static int oauth_use_native(const char *u, int post) {
+#ifdef HAVE_SHELL_CURL
+	if (getenv(post ? _OAUTH_ENV_HTTPCMD : _OAUTH_ENV_HTTPGET)) return 0;
+#endif
+	return nhttp_supported(u);
+}
+
+static char *oauth_native_get (const char *u, const char *q, const char *customheader) {
+	char *t1=NULL, *rv;
+	if (q) {
+		t1=(char*)xmalloc(sizeof(char)*(strlen(u)+strlen(q)+2));
+		strcpy(t1,u); strcat(t1,"?"); strcat(t1,q);
+	}
+	rv = nhttp_request("GET", q?t1:u, customheader, NULL, 0, NULL);
+	xfree(t1);
+	return rv;
+}
+
+static char *oauth_native_send (const char *u, const char *data, size_t len, const char *customheader, const char *httpMethod) {
+	return nhttp_request(httpMethod ? httpMethod : "POST", u, customheader, data ? data : "", len, NULL);
+}
+#endif // built-in HTTP client.
+
+#ifndef HAVE_CURL
+/**
+ * batch requests without libcurl: they are performed one after the
+ * other, via the built-in client where it can handle the URL; all
+ * others are handed to a single curl process (see oauth_exec_batch),
+ * so that they share its connections.
+ * Error codes follow the libcurl numbering (CURLcode).
+ */
+int oauth_http_multi(oauth_http_client *c, oauth_http_request *reqs, int n, oauth_http_done_cb done, void *arg) {
+#if defined(HAVE_NATIVE_HTTP) || defined(HAVE_SHELL_CURL)
+	oauth_http_request **batch;
+	int i, nb = 0, failed = 0;
+	if (n < 0) return -1;
+	batch = (oauth_http_request**) xmalloc((n + 1) * sizeof(oauth_http_request*));
+	for (i = 0; i < n; i++) {
+		oauth_http_request *req = &reqs[i];
+		req->reply = NULL;
+		req->reply_len = 0;
+		req->status = 0;
+		req->error = 0;
+#ifdef HAVE_NATIVE_HTTP
+		if (oauth_use_native(req->url, req->body != NULL)) {
+			const char *method = req->method ? req->method : (req->body ? "POST" : "GET");
+			req->reply = nhttp_request(method, req->url, req->customheader, req->body, req->body_len, &req->status);
+			if (req->reply) req->reply_len = strlen(req->reply);
+			else req->error = req->status ? 56 : 7; // CURLE_RECV_ERROR : CURLE_COULDNT_CONNECT
+			if (done) done(req, arg);
+			continue;
+		}
+#endif
+#ifdef HAVE_SHELL_CURL
+		batch[nb++] = req;
+#else
+		req->error = 1; // CURLE_UNSUPPORTED_PROTOCOL
+		if (done) done(req, arg);
+#endif
+	}
+#ifdef HAVE_SHELL_CURL
+	if (nb > 0) oauth_exec_batch(batch, nb, done, arg);
+#endif
+	xfree(batch);
+	for (i = 0; i < n; i++)
+		if (reqs[i].error) failed++;
+	return failed;
+#else
+	return -1;
+#endif
+}
+#endif
+
 /* wrapper functions */
 
 /**
@@ -599,10 +4360,15 @@ char *oauth_exec_get (const char *u, const char *q) {
 char *oauth_http_get (const char *u, const char *q) {
 #ifdef HAVE_CURL
 	return oauth_curl_get(u,q,NULL);
-#elif defined(HAVE_SHELL_CURL)
-	return oauth_exec_get(u,q);
 #else
+# ifdef HAVE_NATIVE_HTTP
+	if (oauth_use_native(u, 0)) return oauth_native_get(u,q,NULL);
+# endif
+# ifdef HAVE_SHELL_CURL
+	return oauth_exec_get(u,q);
+# else
 	return NULL;
+# endif
 #endif
 }
 
@@ -620,6 +4386,9 @@ char *oauth_http_get (const char *u, const char *q) {
 char *oauth_http_get2 (const char *u, const char *q, const char *customheader) {
 #ifdef HAVE_CURL
 	return oauth_curl_get(u,q,customheader);
+#elif defined(HAVE_NATIVE_HTTP)
+	if (!nhttp_supported(u)) return NULL;
+	return oauth_native_get(u,q,customheader);
 #else
 	return NULL;
 #endif
@@ -640,10 +4409,15 @@ char *oauth_http_get2 (const char *u, const char *q, const char *customheader) {
 char *oauth_http_post (const char *u, const char *p) {
 #ifdef HAVE_CURL
 	return oauth_curl_post(u,p,NULL);
-#elif defined(HAVE_SHELL_CURL)
-	return oauth_exec_post(u,p);
 #else
+# ifdef HAVE_NATIVE_HTTP
+	if (oauth_use_native(u, 1)) return oauth_native_send(u,p,strlen(p),NULL,NULL);
+# endif
+# ifdef HAVE_SHELL_CURL
+	return oauth_exec_post(u,p);
+# else
 	return NULL;
+# endif
 #endif
 }
 
@@ -664,6 +4438,9 @@ char *oauth_http_post (const char *u, const char *p) {
 char *oauth_http_post2 (const char *u, const char *p, const char *customheader) {
 #ifdef HAVE_CURL
 	return oauth_curl_post(u,p,customheader);
+#elif defined(HAVE_NATIVE_HTTP)
+	if (!nhttp_supported(u)) return NULL;
+	return oauth_native_send(u,p,strlen(p),customheader,NULL);
 #else
 	return NULL;
 #endif
@@ -707,6 +4484,9 @@ char *oauth_post_file (const char *u, const char *fn, const size_t len, const ch
 char *oauth_post_data (const char *u, const char *data, size_t len, const char *customheader) {
 #ifdef HAVE_CURL
 	return oauth_curl_post_data (u, data, len, customheader);
+#elif defined(HAVE_NATIVE_HTTP)
+	if (!nhttp_supported(u)) return NULL;
+	return oauth_native_send(u, data, len, customheader, NULL);
 #elif defined(HAVE_SHELL_CURL)
 	fprintf(stderr, "\nliboauth: oauth_post_file requires libcurl. libcurl is not available.\n\n");
 	return NULL;
@@ -718,6 +4498,9 @@ char *oauth_post_data (const char *u, const char *data, size_t len, const char *
 char *oauth_send_data (const char *u, const char *data, size_t len, const char *customheader, const char *httpMethod) {
 #ifdef HAVE_CURL
 	return oauth_curl_send_data (u, data, len, customheader, httpMethod);
+#elif defined(HAVE_NATIVE_HTTP)
+	if (!nhttp_supported(u)) return NULL;
+	return oauth_native_send(u, data, len, customheader, httpMethod);
 #elif defined(HAVE_SHELL_CURL)
 	fprintf(stderr, "\nliboauth: oauth_send_file requires libcurl. libcurl is not available.\n\n");
 	return NULL;
@@ -726,6 +4509,39 @@ char *oauth_send_data (const char *u, const char *data, size_t len, const char *
 #endif
 }
 
+char *oauth_send_iov_with_callback (const char *u, const struct iovec *iov, int iovcnt, const char *customheader, void (*callback)(void*,int,size_t,size_t), void *callback_data, const char *httpMethod) {
+#ifdef HAVE_CURL
+	return oauth_curl_send_iov_with_callback(u, iov, iovcnt, customheader, callback, callback_data, httpMethod);
+#elif defined(HAVE_SHELL_CURL)
+	fprintf(stderr, "\nliboauth: oauth_send_iov_with_callback requires libcurl.\n\n");
+	return NULL;
+#else
+	return (NULL);
+#endif
+}
+
+char *oauth_send_file_with_callback (const char *u, const char *fn, const char *customheader, void (*callback)(void*,int,size_t,size_t), void *callback_data, const char *httpMethod) {
+#ifdef HAVE_CURL
+	return oauth_curl_send_file_with_callback(u, fn, customheader, callback, callback_data, httpMethod);
+#elif defined(HAVE_SHELL_CURL)
+	fprintf(stderr, "\nliboauth: oauth_send_file_with_callback requires libcurl.\n\n");
+	return NULL;
+#else
+	return (NULL);
+#endif
+}
+
+char *oauth_send_multipart (const char *u, oauth_multipart *mp, const char *customheader, void (*callback)(void*,int,size_t,size_t), void *callback_data, const char *httpMethod) {
+#ifdef HAVE_CURL
+	return oauth_curl_send_multipart(u, mp, customheader, callback, callback_data, httpMethod);
+#elif defined(HAVE_SHELL_CURL)
+	fprintf(stderr, "\nliboauth: oauth_send_multipart requires libcurl.\n\n");
+	return NULL;
+#else
+	return (NULL);
+#endif
+}
+
 char *oauth_post_data_with_callback (const char *u, const char *data, size_t len, const char *customheader, void (*callback)(void*,int,size_t,size_t), void *callback_data) {
 #ifdef HAVE_CURL
 	return oauth_curl_post_data_with_callback(u, data, len, customheader, callback, callback_data);
@@ -31,7 +31,7 @@
 typedef struct sha1nfo {
 	uint32_t buffer[BLOCK_LENGTH/4];
 	uint32_t state[HASH_LENGTH/4];
-	uint32_t byteCount;
+	uint64_t byteCount;
 	uint8_t bufferOffset;
 	uint8_t keyBuffer[BLOCK_LENGTH];
 	uint8_t innerHash[HASH_LENGTH];
@@ -146,10 +146,10 @@ void sha1_pad(sha1nfo *s) {
 	sha1_addUncounted(s, 0x80);
 	while (s->bufferOffset != 56) sha1_addUncounted(s, 0x00);
 
-	// Append length in the last 8 bytes
-	sha1_addUncounted(s, 0); // We're only using 32 bit lengths
-	sha1_addUncounted(s, 0); // But SHA-1 supports 64 bit lengths
-	sha1_addUncounted(s, 0); // So zero pad the top bits
+	// Append length (in bits) in the last 8 bytes
+	sha1_addUncounted(s, s->byteCount >> 53);
+	sha1_addUncounted(s, s->byteCount >> 45);
+	sha1_addUncounted(s, s->byteCount >> 37);
 	sha1_addUncounted(s, s->byteCount >> 29); // Shifting to multiply by 8
 	sha1_addUncounted(s, s->byteCount >> 21); // as SHA-1 supports bitstreams as well as
 	sha1_addUncounted(s, s->byteCount >> 13); // byte.
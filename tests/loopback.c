@@ -0,0 +1,337 @@
+/**
+ *  @brief minimal HTTP/1.1 server for the self-tests
+ *  @file loopback.c
+ *  @author The liboauth contributors
+ *
+ * Copyright 2026 The liboauth contributors (see git log)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* The server runs in a thread of the test program and answers each
+ * connection in a thread of its own; the test decides what to send
+ * (including broken replies) in its handler function.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifdef HAVE_PTHREAD
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "loopback.h"
+
+#ifndef MSG_NOSIGNAL
+# define MSG_NOSIGNAL 0
+#endif
+
+static lb_handler handler = NULL;
+static int listen_fd = -1;
+static int port = 0;
+static int n_conn = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct lb_conn {
+  int fd;
+  int id;
+  char *buf;    //< received, not yet consumed data
+  size_t len;
+  size_t alloc;
+};
+
+/* receive more data; @return bytes received, 0 on EOF or error */
+static size_t lb_fill(struct lb_conn *c) {
+  ssize_t rv;
+  if (c->alloc - c->len < 4096) {
+    c->alloc = c->alloc * 2 + 4096;
+    c->buf = (char*) realloc(c->buf, c->alloc);
+  }
+  do {
+    rv = recv(c->fd, c->buf + c->len, c->alloc - c->len - 1, 0);
+  } while (rv < 0 && errno == EINTR);
+  if (rv <= 0) return 0;
+  c->len += rv;
+  c->buf[c->len] = '\0';
+  return rv;
+}
+
+static void lb_consume(struct lb_conn *c, size_t n) {
+  memmove(c->buf, c->buf + n, c->len - n);
+  c->len -= n;
+  c->buf[c->len] = '\0';
+}
+
+/* read exactly n bytes into *out (appended at *olen) */
+static int lb_read(struct lb_conn *c, char **out, size_t *olen, size_t n) {
+  while (c->len < n) {
+    if (!lb_fill(c)) return -1;
+  }
+  *out = (char*) realloc(*out, *olen + n + 1);
+  memcpy(*out + *olen, c->buf, n);
+  *olen += n;
+  (*out)[*olen] = '\0';
+  lb_consume(c, n);
+  return 0;
+}
+
+/* read a line (without its CRLF), @return malloc()ed line or NULL */
+static char *lb_line(struct lb_conn *c) {
+  char *nl, *rv;
+  while (!c->buf || !(nl = strstr(c->buf, "\r\n"))) {
+    if (!lb_fill(c)) return NULL;
+  }
+  rv = strndup(c->buf, nl - c->buf);
+  lb_consume(c, nl - c->buf + 2);
+  return rv;
+}
+
+static int lb_read_request(struct lb_conn *c, lb_request *rq) {
+  char *hdr, *te, *cl, *ex;
+  size_t hl;
+
+  memset(rq, 0, sizeof(lb_request));
+  while (!c->buf || !(hdr = strstr(c->buf, "\r\n\r\n"))) {
+    if (!lb_fill(c)) return -1;
+  }
+  hl = hdr - c->buf;
+  c->buf[hl] = '\0';
+  rq->path = (char*) calloc(1, hl + 1);
+  if (sscanf(c->buf, "%15s %s", rq->method, rq->path) != 2) return -1;
+  hdr = strstr(c->buf, "\r\n");
+  rq->headers = strdup(hdr ? hdr + 2 : "");
+  lb_consume(c, hl + 4);
+
+  if ((ex = lb_header(rq, "Expect"))) {
+    if (!strcasecmp(ex, "100-continue")) lb_send(c->fd, "HTTP/1.1 100 Continue\r\n\r\n", 25);
+    free(ex);
+  }
+  te = lb_header(rq, "Transfer-Encoding");
+  cl = lb_header(rq, "Content-Length");
+  rq->body = strdup("");
+  if (te && strstr(te, "chunked")) {
+    for (;;) {
+      char *line = lb_line(c);
+      size_t n;
+      if (!line) return -1;
+      n = strtoul(line, NULL, 16);
+      free(line);
+      if (n == 0) break;
+      if (lb_read(c, &rq->body, &rq->len, n)) return -1;
+      if (!(line = lb_line(c))) return -1;
+      free(line);
+    }
+    for (;;) { // trailers
+      char *line = lb_line(c);
+      if (!line) return -1;
+      if (!*line) { free(line); break; }
+      free(line);
+    }
+  } else if (cl) {
+    if (lb_read(c, &rq->body, &rq->len, strtoul(cl, NULL, 10))) return -1;
+  }
+  free(te);
+  free(cl);
+  rq->conn = c->id;
+  return 0;
+}
+
+static void lb_request_free(lb_request *rq) {
+  free(rq->path);
+  free(rq->headers);
+  free(rq->body);
+}
+
+static void *lb_conn_thread(void *arg) {
+  struct lb_conn *c = (struct lb_conn*) arg;
+  lb_request rq;
+  int nth = 0;
+  for (;;) {
+    int keep;
+    char *conn;
+    if (lb_read_request(c, &rq)) {
+      lb_request_free(&rq);
+      break;
+    }
+    rq.nth = ++nth;
+    keep = handler(c->fd, &rq) == 0;
+    conn = lb_header(&rq, "Connection");
+    if (conn && !strcasecmp(conn, "close")) keep = 0;
+    free(conn);
+    lb_request_free(&rq);
+    if (!keep) break;
+  }
+  close(c->fd);
+  free(c->buf);
+  free(c);
+  return NULL;
+}
+
+static void *lb_accept_thread(void *arg) {
+  for (;;) {
+    pthread_t t;
+    struct lb_conn *c;
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      break;
+    }
+    c = (struct lb_conn*) calloc(1, sizeof(struct lb_conn));
+    c->fd = fd;
+    pthread_mutex_lock(&lock);
+    c->id = ++n_conn;
+    pthread_mutex_unlock(&lock);
+    if (pthread_create(&t, NULL, lb_conn_thread, c)) {
+      close(fd);
+      free(c);
+      continue;
+    }
+    pthread_detach(t);
+  }
+  return NULL;
+}
+
+/**
+ * start the server on a free port of 127.0.0.1.
+ * @return the port or -1 on error
+ */
+int lb_start(lb_handler h) {
+  struct sockaddr_in sa;
+  socklen_t sl = sizeof(sa);
+  pthread_t t;
+  int one = 1;
+
+  signal(SIGPIPE, SIG_IGN);
+  handler = h;
+  listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (listen_fd < 0) return -1;
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  sa.sin_port = 0;
+  if (bind(listen_fd, (struct sockaddr*) &sa, sizeof(sa))
+      || listen(listen_fd, 64)
+      || getsockname(listen_fd, (struct sockaddr*) &sa, &sl)) {
+    close(listen_fd);
+    return -1;
+  }
+  port = ntohs(sa.sin_port);
+  if (pthread_create(&t, NULL, lb_accept_thread, NULL)) return -1;
+  pthread_detach(t);
+  return port;
+}
+
+int lb_port(void) {
+  return port;
+}
+
+/* number of connections accepted so far */
+int lb_connections(void) {
+  int n;
+  pthread_mutex_lock(&lock);
+  n = n_conn;
+  pthread_mutex_unlock(&lock);
+  return n;
+}
+
+/* "http://127.0.0.1:<port><path>", to be freed */
+char *lb_url(const char *path) {
+  char *rv = (char*) malloc(strlen(path) + 32);
+  sprintf(rv, "http://127.0.0.1:%d%s", port, path);
+  return rv;
+}
+
+void lb_send(int fd, const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t rv = send(fd, data, len, MSG_NOSIGNAL);
+    if (rv < 0 && errno == EINTR) continue;
+    if (rv <= 0) return;
+    data += rv;
+    len -= rv;
+  }
+}
+
+/**
+ * send a complete reply with a Content-Length.
+ * @param headers additional header lines, each terminated by "\r\n" (or NULL)
+ */
+void lb_reply(int fd, int status, const char *headers, const char *body, size_t len) {
+  char head[256];
+  snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\nContent-Length: %lu\r\n",
+      status, status < 300 ? "OK" : "Status", (unsigned long) len);
+  lb_send(fd, head, strlen(head));
+  if (headers) lb_send(fd, headers, strlen(headers));
+  lb_send(fd, "\r\n", 2);
+  if (len > 0) lb_send(fd, body, len);
+}
+
+/* value of a request header, to be freed (or NULL) */
+char *lb_header(const lb_request *rq, const char *name) {
+  size_t nl = strlen(name);
+  const char *h = rq->headers;
+  while (h && *h) {
+    size_t l = strcspn(h, "\r\n");
+    if (l > nl && !strncasecmp(h, name, nl) && h[nl] == ':') {
+      const char *v = h + nl + 1;
+      while (*v == ' ') v++;
+      return strndup(v, l - (v - h));
+    }
+    h += l;
+    h += strspn(h, "\r\n");
+  }
+  return NULL;
+}
+
+/**
+ * value of a query parameter, or of an OAuth parameter in the
+ * Authorization header; to be freed (or NULL)
+ */
+char *lb_param(const lb_request *rq, const char *name) {
+  size_t nl = strlen(name);
+  const char *p = strchr(rq->path, '?');
+  char *auth, *rv = NULL;
+  while (p) {
+    p++;
+    if (!strncmp(p, name, nl) && p[nl] == '=')
+      return strndup(p + nl + 1, strcspn(p + nl + 1, "&"));
+    p = strchr(p, '&');
+  }
+  if ((auth = lb_header(rq, "Authorization"))) {
+    char *a = strstr(auth, name);
+    if (a && a[nl] == '=' && a[nl + 1] == '"')
+      rv = strndup(a + nl + 2, strcspn(a + nl + 2, "\""));
+    free(auth);
+  }
+  return rv;
+}
+
+#endif // HAVE_PTHREAD
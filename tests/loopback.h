@@ -0,0 +1,28 @@
+/* minimal HTTP/1.1 server on 127.0.0.1 for the self-tests
+ * (requires POSIX threads) */
+
+typedef struct {
+  char method[16];
+  char *path;     //< path and query
+  char *headers;  //< header lines, "\r\n" separated
+  char *body;     //< request body (NUL terminated)
+  size_t len;     //< length of body
+  int conn;       //< number of the connection, counted from 1
+  int nth;        //< number of the request on that connection, from 1
+} lb_request;
+
+/**
+ * answer a request by writing to fd.
+ * @return 0 to keep the connection open, -1 to close it
+ */
+typedef int (*lb_handler)(int fd, const lb_request *rq);
+
+int lb_start(lb_handler h);
+int lb_port(void);
+int lb_connections(void);
+char *lb_url(const char *path);
+
+void lb_send(int fd, const char *data, size_t len);
+void lb_reply(int fd, int status, const char *headers, const char *body, size_t len);
+char *lb_header(const lb_request *rq, const char *name);
+char *lb_param(const lb_request *rq, const char *name);
@@ -69,10 +69,42 @@ int my_data_post(char *url, char *data) {
   return 0;
 }
 
+/* hash all files given on the command-line concurrently and
+ * print "<path>\toauth_body_hash=xxx" for each of them.
+ * usage: oauthbodyhash [-j <threads>] <file> [<file>...]
+ */
+int hash_files(int argc, char **argv) {
+  int nthreads = 0;
+  int i, n, failed;
+  char **results;
+
+  if (argc > 2 && !strcmp(argv[1], "-j")) {
+    nthreads = atoi(argv[2]);
+    argc -= 2; argv += 2;
+  }
+  n = argc - 1;
+  results = (char**) calloc(n, sizeof(char*));
+  if (!results) return 1;
+
+  failed = oauth_body_hash_files(n, (const char**) &argv[1], results, nthreads);
+  for (i = 0; i < n; i++) {
+    if (results[i]) {
+      printf("%s\t%s\n", argv[i+1], results[i]);
+      free(results[i]);
+    } else {
+      fprintf(stderr, "%s: can not read file\n", argv[i+1]);
+    }
+  }
+  free(results);
+  return failed ? 1 : 0;
+}
+
 int main (int argc, char **argv) {
   char *base_url = "http://localhost/oauthtest.php";
   char *teststring="Hello World!";
 
+  if (argc > 1) return hash_files(argc, argv);
+
   /* TEST_BODY_HASH_FILE and TEST_BODY_HASH_DATA are only
    * here as examples and for testing during development.
    *
@@ -0,0 +1,146 @@
+/**
+ *  @brief example code for driving OAuth requests from an event loop
+ *  @file oauthloop.c
+ *  @author The liboauth contributors
+ *
+ * Copyright 2026 The liboauth contributors (see git log)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* a minimal poll(2) based reactor that performs a number of signed
+ * GET requests without blocking on any of them:
+ *
+ *   ./oauthloop http://term.ie/oauth/example/echo_api.php 20
+ *
+ * The same callbacks map directly to epoll_ctl(), libevent's
+ * event_add() or libuv's uv_poll_start() and uv_timer_start().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <oauth.h>
+
+#define MAXFDS 256
+
+struct reactor {
+  struct pollfd fds[MAXFDS];
+  int nfds;
+  long timeout_ms; //< -1: no timer
+  int pending;
+};
+
+static int socket_cb(int fd, int what, void *arg) {
+  struct reactor *r = (struct reactor*) arg;
+  int i;
+  for (i=0; i < r->nfds; i++) {
+    if (r->fds[i].fd == fd) break;
+  }
+  if (what & OA_HTTP_POLL_REMOVE) {
+    if (i < r->nfds) r->fds[i] = r->fds[--r->nfds];
+    return 0;
+  }
+  if (i == r->nfds) {
+    if (r->nfds == MAXFDS) return -1;
+    r->nfds++;
+  }
+  r->fds[i].fd = fd;
+  r->fds[i].events = ((what & OA_HTTP_POLL_IN) ? POLLIN : 0) | ((what & OA_HTTP_POLL_OUT) ? POLLOUT : 0);
+  return 0;
+}
+
+static int timer_cb(long timeout_ms, void *arg) {
+  struct reactor *r = (struct reactor*) arg;
+  r->timeout_ms = timeout_ms;
+  return 0;
+}
+
+static void done(oauth_http_request *req, void *arg) {
+  struct reactor *r = (struct reactor*) arg;
+  r->pending--;
+  printf("status: %ld error: %d reply: %.*s\n", req->status, req->error,
+      req->reply ? (int) strcspn(req->reply, "\r\n") : 0, req->reply ? req->reply : "");
+  free(req->reply);
+  free((char*) req->url);
+}
+
+int main (int argc, char **argv) {
+  const char *c_key    = "key"; //< consumer key
+  const char *c_secret = "secret"; //< consumer secret
+
+  struct reactor r;
+  oauth_http_loop *loop;
+  oauth_http_request *reqs;
+  int i, n;
+
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <url> [count]\n", argv[0]);
+    return 1;
+  }
+  n = argc > 2 ? atoi(argv[2]) : 10;
+  if (n < 1) n = 1;
+
+  memset(&r, 0, sizeof(r));
+  r.timeout_ms = -1;
+
+  loop = oauth_http_loop_new(oauth_http_client_default(), socket_cb, timer_cb, &r);
+  if (!loop) {
+    fprintf(stderr, "liboauth was compiled without libcurl.\n");
+    return 1;
+  }
+
+  reqs = (oauth_http_request*) calloc(n, sizeof(oauth_http_request));
+  for (i=0; i < n; i++) {
+    char url[1024];
+    snprintf(url, sizeof(url), "%s%cbar=%d", argv[1], strchr(argv[1], '?') ? '&' : '?', i);
+    reqs[i].url = oauth_sign_url2(url, NULL, OA_HMAC, NULL, c_key, c_secret, NULL, NULL);
+    if (oauth_http_loop_add(loop, &reqs[i], done, &r)) {
+      free((char*) reqs[i].url);
+      continue;
+    }
+    r.pending++;
+  }
+
+  while (r.pending > 0) {
+    struct pollfd fds[MAXFDS];
+    int nfds = r.nfds, rv;
+    memcpy(fds, r.fds, nfds * sizeof(struct pollfd));
+    rv = poll(fds, nfds, (int) r.timeout_ms);
+    if (rv < 0) break;
+    if (rv == 0) {
+      r.timeout_ms = -1;
+      oauth_http_loop_timeout(loop);
+      continue;
+    }
+    for (i=0; i < nfds; i++) {
+      int ev = 0;
+      if (fds[i].revents & POLLIN)  ev |= OA_HTTP_POLL_IN;
+      if (fds[i].revents & POLLOUT) ev |= OA_HTTP_POLL_OUT;
+      if (fds[i].revents & (POLLERR|POLLHUP)) ev |= OA_HTTP_POLL_ERR;
+      if (ev) oauth_http_loop_socket_action(loop, fds[i].fd, ev);
+    }
+  }
+
+  oauth_http_loop_free(loop);
+  free(reqs);
+  oauth_http_global_cleanup();
+  return 0;
+}
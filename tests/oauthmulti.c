@@ -0,0 +1,83 @@
+/**
+ *  @brief example code for concurrent OAuth requests
+ *  @file oauthmulti.c
+ *  @author The liboauth contributors
+ *
+ * Copyright 2026 The liboauth contributors (see git log)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* sign a number of GET requests and perform them concurrently:
+ *
+ *   ./oauthmulti http://term.ie/oauth/example/echo_api.php 20
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <oauth.h>
+
+static void done(oauth_http_request *req, void *arg) {
+  int *completed = (int*) arg;
+  (*completed)++;
+  printf("#%d status: %ld error: %d reply: %.*s\n",
+      *(int*)req->userdata, req->status, req->error,
+      req->reply ? (int) strcspn(req->reply, "\r\n") : 0, req->reply ? req->reply : "");
+}
+
+int main (int argc, char **argv) {
+  const char *c_key    = "key"; //< consumer key
+  const char *c_secret = "secret"; //< consumer secret
+  const char *t_key    = "accesskey"; //< access token key
+  const char *t_secret = "accesssecret"; //< access token secret
+
+  oauth_http_request *reqs;
+  int *ids;
+  int i, n, failed, completed = 0;
+
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <url> [count]\n", argv[0]);
+    return 1;
+  }
+  n = argc > 2 ? atoi(argv[2]) : 10;
+  if (n < 1) n = 1;
+
+  reqs = (oauth_http_request*) calloc(n, sizeof(oauth_http_request));
+  ids = (int*) calloc(n, sizeof(int));
+  for (i=0; i < n; i++) {
+    char url[1024];
+    snprintf(url, sizeof(url), "%s%cmethod=foo%%20bar&bar=%d", argv[1], strchr(argv[1], '?') ? '&' : '?', i);
+    ids[i] = i;
+    reqs[i].url = oauth_sign_url2(url, NULL, OA_HMAC, NULL, c_key, c_secret, t_key, t_secret);
+    reqs[i].userdata = &ids[i];
+  }
+
+  failed = oauth_http_multi(oauth_http_client_default(), reqs, n, done, &completed);
+  printf("%d of %d requests completed, %d failed.\n", completed, n, failed);
+
+  for (i=0; i < n; i++) {
+    free((char*) reqs[i].url);
+    free(reqs[i].reply);
+  }
+  free(reqs);
+  free(ids);
+  oauth_http_global_cleanup();
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,83 @@
+/**
+ *  @brief example code for the persistent TLS session cache
+ *  @file oauthtlscache.c
+ *  @author The liboauth contributors
+ *
+ * Copyright 2026 The liboauth contributors (see git log)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* test against a local TLS stub server:
+ *
+ *   openssl req -x509 -newkey rsa:2048 -nodes -subj /CN=localhost \
+ *     -keyout /tmp/key.pem -out /tmp/cert.pem
+ *   openssl s_server -accept 8443 -www -cert /tmp/cert.pem -key /tmp/key.pem
+ *
+ *   export CURLOPT_SSL_VERIFYPEER=0
+ *   ./oauthtlscache https://localhost:8443/ /tmp/sessions
+ *   ./oauthtlscache https://localhost:8443/ /tmp/sessions
+ *
+ * or, without naming the file in the program at all:
+ *
+ *   OAUTH_HTTP_SESSION_CACHE=/tmp/sessions ./oauthtlscache https://localhost:8443/
+ *
+ * The s_server status page reports "New, ..." for the first
+ * run and "Reused, ..." once the session was resumed from the cache.
+ * Neither run flushes the cache or calls oauth_http_global_cleanup();
+ * it is written back when the process exits.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <oauth.h>
+
+int main (int argc, char **argv) {
+  char *reply, *status;
+  int loaded;
+
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <https-url> [session-cache-file]\n", argv[0]);
+    return 1;
+  }
+
+  if (argc > 2) {
+    loaded = oauth_http_session_cache(argv[2]);
+    if (loaded < 0) {
+      fprintf(stderr, "TLS session export is not supported by this libcurl.\n");
+    } else {
+      printf("loaded %d session(s)\n", loaded);
+    }
+  }
+
+  reply = oauth_http_client_get(oauth_http_client_default(), argv[1], NULL, NULL);
+  if (!reply) {
+    printf("Error performing the request\n");
+    return 1;
+  }
+
+  if ((status = strstr(reply, "New,")) || (status = strstr(reply, "Reused,"))) {
+    printf("%.*s\n", (int) strcspn(status, "\r\n"), status);
+  } else {
+    printf("REPLY: %s\n", reply);
+  }
+  free(reply);
+  return 0; // the session cache is saved on exit
+}
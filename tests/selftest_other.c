@@ -27,6 +27,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
 #include <oauth.h>
 
 #include "commontest.h"
@@ -72,6 +74,85 @@ int main (int argc, char **argv) {
     fail|=1;
   }
 
+  if (loglevel) printf("\n *** Testing incremental body hash calculation.\n");
+
+  oauth_body_hash_ctx *bhctx = oauth_body_hash_init();
+  if (bhctx) {
+    oauth_body_hash_update(bhctx, teststring, 5);
+    oauth_body_hash_update(bhctx, teststring + 5, 0);
+    oauth_body_hash_update(bhctx, teststring + 5, strlen(teststring) - 5);
+    bh=oauth_body_hash_final(bhctx);
+    if (!bh || strcmp(bh,"oauth_body_hash=Lve95gjOVATpfV8EL5X4nxwjKHE=")) fail|=1;
+    free(bh);
+  } else {
+    fail|=1;
+  }
+
+  if (loglevel) printf("\n *** Testing scatter-gather body hash calculation.\n");
+
+  struct iovec bhiov[3];
+  bhiov[0].iov_base = (void*) teststring;      bhiov[0].iov_len = 6;
+  bhiov[1].iov_base = (void*) teststring;      bhiov[1].iov_len = 0;
+  bhiov[2].iov_base = (void*) (teststring+6);  bhiov[2].iov_len = strlen(teststring) - 6;
+  bh=oauth_body_hash_iov(bhiov, 3);
+  if (!bh || strcmp(bh,"oauth_body_hash=Lve95gjOVATpfV8EL5X4nxwjKHE=")) fail|=1;
+  free(bh);
+
+  if (loglevel) printf("\n *** Testing body hash calculation of a file.\n");
+
+  char tmpfn[] = "/tmp/liboauth-bodyhash-XXXXXX";
+  int tmpfd = mkstemp(tmpfn);
+  if (tmpfd >= 0 && write(tmpfd, teststring, strlen(teststring)) == strlen(teststring)) {
+    close(tmpfd);
+    bh=oauth_body_hash_file(tmpfn);
+    if (!bh || strcmp(bh,"oauth_body_hash=Lve95gjOVATpfV8EL5X4nxwjKHE=")) fail|=1;
+    free(bh);
+  } else {
+    fail|=1;
+  }
+  if (tmpfd >= 0) unlink(tmpfn);
+
+  if (loglevel) printf("\n *** Testing multipart body serialization.\n");
+
+  oauth_multipart *mp = oauth_multipart_new();
+  char mpfn[] = "/tmp/liboauth-multipart-XXXXXX";
+  int mpfd = mkstemp(mpfn);
+  if (mpfd >= 0 && write(mpfd, teststring, strlen(teststring)) == strlen(teststring)) {
+    const char *bnd = strstr(oauth_multipart_content_type(mp), "boundary=");
+    const char *base = strrchr(mpfn, '/') + 1;
+    char *expect = malloc(1024);
+    close(mpfd);
+    oauth_multipart_add_field(mp, "title", "a \"b\"", 5);
+    oauth_multipart_add_file(mp, "photo", mpfn, "text/plain");
+    bnd += 9;
+    snprintf(expect, 1024,
+        "--%s\r\nContent-Disposition: form-data; name=\"title\"\r\n\r\na \"b\"\r\n"
+        "--%s\r\nContent-Disposition: form-data; name=\"photo\"; filename=\"%s\"\r\n"
+        "Content-Type: text/plain\r\n\r\n%s\r\n--%s--\r\n",
+        bnd, bnd, base, teststring, bnd);
+    if (oauth_multipart_length(mp) != (long long) strlen(expect)) fail|=1;
+    bh=oauth_multipart_body_hash(mp);
+    char *bh2=oauth_body_hash_data(strlen(expect), expect);
+    if (!bh || !bh2 || strcmp(bh, bh2)) fail|=1;
+    free(bh); free(bh2); free(expect);
+  } else {
+    fail|=1;
+  }
+  if (mpfd >= 0) unlink(mpfn);
+  oauth_multipart_free(mp);
+
+  if (loglevel) printf("\n *** Testing gzip body compression.\n");
+
+  size_t gzlen = 0;
+  char *gzbh = NULL;
+  char *gz = oauth_body_gzip(teststring, strlen(teststring), &gzlen, &gzbh);
+  if (gz) { // NULL: compiled without zlib
+    if (gzlen < 18 || (unsigned char)gz[0] != 0x1f || (unsigned char)gz[1] != 0x8b) fail|=1;
+    bh=oauth_body_hash_data(gzlen, gz);
+    if (!bh || !gzbh || strcmp(bh, gzbh)) fail|=1;
+    free(bh); free(gzbh); free(gz);
+  }
+
   if (loglevel) printf("\n *** Testing PLAINTEXT signature.\n");
   fail |= test_sign_get(
       "http://host.net/resource" "?" "name=value&name=value"